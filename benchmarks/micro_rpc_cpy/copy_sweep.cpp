@@ -3,6 +3,7 @@
 #include <chrono>
 #include <pthread.h>
 #include <string.h>
+#include <zio.h>
 #include <sys/socket.h>
 #include <linux/perf_event.h>
 #include <linux/hw_breakpoint.h>
@@ -180,7 +181,8 @@ static void *receiver_run(void *arg)
     while(WHILE_COND) {
         void *buff = aligned_alloc(PAGE_SIZE, max_bytes);
         void *buff_copy = aligned_alloc(PAGE_SIZE, max_bytes * MAX_NUM_COPYS);
-            recv(-2, buff, max_bytes, 0xdeadbeef);
+        if (ZIO_AVAILABLE())
+            zio_register_buffer(buff, max_bytes);
     //for(int i = 0; i < 200; ++i) {
         //void *buff = NULL, *buff_copy = NULL;
         //while(!send_buf->pop(&buff, &buff_copy) && WHILE_COND);
@@ -0,0 +1,320 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <zio.h>
+
+// Correctness cases for copy elision, run with copy_interpose.so preloaded
+// (also with ZIO_REMAP=1). Every case checks the data the application
+// reads; a hang is a failure as well.
+#define PAGE_SIZE 4096
+#define SIZE (8 * 1024 * 1024)
+
+static int failed;
+
+static char pattern(size_t i, int seed)
+{
+    return (char)(i % 251 + seed);
+}
+
+static void fill(char *buf, size_t len, int seed)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = pattern(i, seed);
+}
+
+static void check(const char *what, const char *buf, size_t len, int seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != pattern(i, seed)) {
+            printf("FAIL %s: byte %zu is %d, expected %d\n", what, i, buf[i],
+                   pattern(i, seed));
+            failed = 1;
+            return;
+        }
+    }
+    printf("ok %s\n", what);
+}
+
+static char *buffer(size_t len)
+{
+    return (char *)aligned_alloc(PAGE_SIZE, len + PAGE_SIZE);
+}
+
+struct peer {
+    int fd;
+    char *orig; // written first unless NULL
+    char *copy;
+    char *out;
+    size_t len;
+};
+
+// Writes the original and reads the elided copy while the sender is
+// blocked, then drains the socket
+static void *peer_read(void *arg)
+{
+    struct peer *p = (struct peer *)arg;
+    volatile char sum = 0;
+    size_t got = 0;
+    ssize_t ret;
+
+    usleep(100000);
+    if (p->orig)
+        memset(p->orig, 0, p->len);
+    for (size_t i = 0; i < p->len; i += PAGE_SIZE)
+        sum += p->copy[i];
+    while (got < p->len && (ret = read(p->fd, p->out + got, p->len - got)) > 0)
+        got += ret;
+    return NULL;
+}
+
+typedef ssize_t (*send_fn)(int fd, const char *buf, size_t len);
+
+// A send of an elided copy that blocks on a full pipe or socket must not
+// keep the peer from faulting in the copy, nor with write_orig from writing
+// the original first. send_part() is called with at most chunk bytes at a
+// time.
+static void test_blocking(const char *what, int wfd, int rfd, size_t chunk,
+                          send_fn send_part, bool write_orig)
+{
+    char *orig = buffer(SIZE), *copy = buffer(SIZE), *out = buffer(SIZE);
+    struct peer p;
+    pthread_t t;
+    size_t sent = 0;
+    ssize_t ret;
+
+    fill(orig, SIZE, 1);
+    memcpy(copy, orig, SIZE);
+    p = {rfd, write_orig ? orig : NULL, copy, out, SIZE};
+    pthread_create(&t, NULL, peer_read, &p);
+    while (sent < SIZE &&
+           (ret = send_part(wfd, copy + sent, MIN(chunk, SIZE - sent))) > 0)
+        sent += ret;
+    pthread_join(t, NULL);
+    check(what, out, SIZE, 1);
+    check("copy read by the peer", copy, SIZE, 1);
+    close(wfd);
+    close(rfd);
+}
+
+static ssize_t send_stream(int fd, const char *buf, size_t len)
+{
+    return send(fd, buf, len, 0);
+}
+
+static ssize_t write_pipe(int fd, const char *buf, size_t len)
+{
+    return write(fd, buf, len);
+}
+
+// Three pieces of unequal length
+static ssize_t writev_pipe(int fd, const char *buf, size_t len)
+{
+    struct iovec iov[3] = {{(void *)buf, len / 4},
+                           {(void *)(buf + len / 4), len / 2},
+                           {(void *)(buf + len / 4 + len / 2),
+                            len - len / 4 - len / 2}};
+
+    return writev(fd, iov, 3);
+}
+
+// Two pieces, through sendmsg()
+static ssize_t sendmsg_stream(int fd, const char *buf, size_t len)
+{
+    struct iovec iov[2] = {{(void *)buf, len / 3},
+                           {(void *)(buf + len / 3), len - len / 3}};
+    struct msghdr mh;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 2;
+    return sendmsg(fd, &mh, 0);
+}
+
+static struct sockaddr_un dgram_addr;
+
+static ssize_t sendto_dgram(int fd, const char *buf, size_t len)
+{
+    return sendto(fd, buf, len, 0, (struct sockaddr *)&dgram_addr,
+                  sizeof(dgram_addr));
+}
+
+static void test_blocking_send(const char *what, bool write_orig)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    test_blocking(what, sv[0], sv[1], SIZE, send_stream, write_orig);
+}
+
+static void test_blocking_write(const char *what, send_fn send_part,
+                                bool write_orig)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    test_blocking(what, fds[1], fds[0], SIZE, send_part, write_orig);
+}
+
+static void test_blocking_sendmsg(void)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    test_blocking("blocking sendmsg, original written", sv[0], sv[1], SIZE,
+                  sendmsg_stream, true);
+}
+
+// pwrite() of an elided copy at an unaligned file offset, with the original
+// written before the file is read back
+static void test_pwrite(void)
+{
+    char *orig = buffer(SIZE), *copy = buffer(SIZE), *out = buffer(SIZE);
+    char path[] = "/tmp/elide_test.XXXXXX";
+    size_t done = 0;
+    ssize_t ret;
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    unlink(path);
+    fill(orig, SIZE, 4);
+    memcpy(copy, orig, SIZE);
+    while (done < SIZE &&
+           (ret = pwrite(fd, copy + done, SIZE - done, 100 + done)) > 0)
+        done += ret;
+    memset(orig, 0, SIZE);
+    done = 0;
+    while (done < SIZE &&
+           (ret = pread(fd, out + done, SIZE - done, 100 + done)) > 0)
+        done += ret;
+    check("pwrite to a file", out, SIZE, 4);
+    check("copy written to a file", copy, SIZE, 4);
+    close(fd);
+}
+
+// Datagrams to an unconnected socket, each one read whole by the peer
+static void test_blocking_sendto(void)
+{
+    int rfd = socket(AF_UNIX, SOCK_DGRAM, 0), wfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+
+    memset(&dgram_addr, 0, sizeof(dgram_addr));
+    dgram_addr.sun_family = AF_UNIX;
+    snprintf(dgram_addr.sun_path + 1, sizeof(dgram_addr.sun_path) - 1,
+             "elide_test.%d", getpid());
+    if (rfd < 0 || wfd < 0 ||
+        bind(rfd, (struct sockaddr *)&dgram_addr, sizeof(dgram_addr)) != 0) {
+        perror("datagram socket");
+        exit(1);
+    }
+    test_blocking("blocking sendto of datagrams", wfd, rfd, 16 * PAGE_SIZE,
+                  sendto_dgram, true);
+}
+
+// Copy orig to a, write pages of orig every stride bytes, then copy a to b:
+// the written pages of a are no longer tracked, the rest are still copies of
+// orig, and b must read the data a held
+static void test_chain(size_t offset, size_t written, size_t stride)
+{
+    char *orig = buffer(SIZE) + offset, *a = buffer(SIZE) + offset;
+    char *b = buffer(SIZE) + offset;
+
+    fill(orig, SIZE, 2);
+    memcpy(a, orig, SIZE);
+    for (size_t i = 0; i < SIZE; i += stride)
+        memset(orig + i, 0, written);
+    memcpy(b, a, SIZE);
+    check("chained copy", b, SIZE, 2);
+    check("copy of a written original", a, SIZE, 2);
+}
+
+// Copy orig to a, then overwrite a from a source 100 bytes further into its
+// page: the pages of a the second copy covers whole are dropped, not filled
+// from orig, and must not fault forever
+static void test_overwrite(size_t offset)
+{
+    char *orig = buffer(SIZE) + offset, *a = buffer(SIZE) + offset;
+    char *src = buffer(SIZE + 100) + offset;
+
+    fill(orig, SIZE, 5);
+    fill(src + 100, SIZE, 6);
+    memcpy(a, orig, SIZE);
+    memcpy(a, src + 100, SIZE);
+    check("overwritten copy", a, SIZE, 6);
+    check("original of an overwritten copy", orig, SIZE, 5);
+}
+
+// Copy orig to a at the same page offset, write pages of a every stride
+// bytes, then copy orig to b: with ZIO_REMAP=1 the first copy moves the pages
+// of orig into a, the writes hand orig its own copy of those pages back, and
+// the second copy reads from both
+static void test_remap_source(size_t offset, size_t written, size_t stride)
+{
+    char *orig = buffer(SIZE) + offset, *a = buffer(SIZE) + offset;
+    char *b = buffer(SIZE) + offset;
+
+    fill(orig, SIZE, 3);
+    memcpy(a, orig, SIZE);
+    for (size_t i = 0; i < SIZE; i += stride)
+        memset(a + i, 0, written);
+    memcpy(b, orig, SIZE);
+    check("copy of a remapped source", b, SIZE, 3);
+    check("remapped source", orig, SIZE, 3);
+}
+
+int main(int argc, char *argv[])
+{
+    // every case copies from one call site and reads all of the copy, which
+    // the cost model would soon stop eliding
+    if (!getenv("ZIO_ELIDE_WARMUP")) {
+        setenv("ZIO_ELIDE_WARMUP", "1099511627776", 1);
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IONBF, 0);
+    test_blocking_send("blocking send", false);
+    test_blocking_send("blocking send, original written", true);
+    test_blocking_write("blocking write to a pipe", write_pipe, false);
+    test_blocking_write("blocking write to a pipe, original written",
+                        write_pipe, true);
+    test_blocking_write("blocking writev to a pipe, original written",
+                        writev_pipe, true);
+    test_blocking_sendto();
+    test_blocking_sendmsg();
+    test_pwrite();
+    test_chain(0, 4 * PAGE_SIZE, SIZE);
+    test_chain(100, 4 * PAGE_SIZE, SIZE);
+    test_chain(0, 1, 64 * PAGE_SIZE);
+    test_chain(100, 1, 64 * PAGE_SIZE);
+    test_remap_source(0, 1, SIZE);
+    test_remap_source(100, 1, SIZE);
+    test_remap_source(0, 1, 64 * PAGE_SIZE);
+    test_overwrite(0);
+    test_overwrite(100);
+    // once more with the other way of filling in missing pages
+    if (!failed && !getenv("ZIO_FAULT_MODE")) {
+        printf("ZIO_FAULT_MODE=mmap\n");
+        setenv("ZIO_FAULT_MODE", "mmap", 1);
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        return 1;
+    }
+    return failed;
+}
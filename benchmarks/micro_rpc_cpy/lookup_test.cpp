@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <skiplist.h>
+
+// Cost of finding the tracked buffer that contains an address, as done for
+// every page of a send/pwrite and on every missing fault. The number of
+// tracked buffers is swept from 10 to 1M, the time per lookup should stay
+// roughly flat.
+#define PAGE_SIZE 4096
+#define BUF_PAGES 4
+#define LOOKUPS (1 << 22)
+
+#include <chrono>
+using namespace std::chrono;
+#define TIME_NOW high_resolution_clock::now()
+#define TIME_DIFF(a, b) duration_cast<nanoseconds>(a - b).count()
+
+static uint64_t lfsr_fast(uint64_t lfsr)
+{
+  lfsr ^= lfsr >> 7;
+  lfsr ^= lfsr << 9;
+  lfsr ^= lfsr >> 13;
+  return lfsr;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t max_entries = argc > 1 ? strtoull(argv[1], NULL, 0) : 1000000;
+    // leave a one page gap between buffers so that misses are exercised too
+    const uint64_t stride = (BUF_PAGES + 1) * PAGE_SIZE;
+    const uint64_t base = 1ULL << 32;
+
+    for (uint64_t n = 10; n <= max_entries; n *= 10) {
+        skiplist list;
+        skiplist_init(&list);
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t addr = base + i * stride;
+            skiplist_insert_with_addr(&list, addr + PAGE_SIZE, addr, addr,
+                                      BUF_PAGES * PAGE_SIZE - PAGE_SIZE,
+                                      PAGE_SIZE);
+        }
+
+        uint64_t lfsr = 1, hits = 0;
+        auto start = TIME_NOW;
+        for (int i = 0; i < LOOKUPS; i++) {
+            lfsr = lfsr_fast(lfsr);
+            uint64_t addr = base + lfsr % (n * stride);
+            if (skiplist_search_buffer_fallin(&list, addr))
+                hits++;
+        }
+        auto stop = TIME_NOW;
+
+        printf("Entries: %lu\tLookup: %.1f ns\tHits: %.2f%%\n", n,
+               (double)TIME_DIFF(stop, start) / LOOKUPS,
+               (double)hits / LOOKUPS * 100.0);
+        fflush(stdout);
+    }
+    return 0;
+}
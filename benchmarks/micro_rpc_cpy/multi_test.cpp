@@ -8,6 +8,7 @@
 #include <sys/syscall.h>         /* Definition of SYS_* constants */
 #include <sys/socket.h>
 #include <string.h>
+#include <zio.h>
 #define PAGE_SIZE 4096
 #define PAGE_BITS 12
 #define CL_BITS 6
@@ -49,7 +50,8 @@ int main(int argc, char *argv[])
     size = 4096;
     test1 = (int*)aligned_alloc(PAGE_SIZE, size);
     test2 = (int*)aligned_alloc(PAGE_SIZE, size);
-    recv(-2, test1, size, 0xdeadbeef);
+    if (ZIO_AVAILABLE())
+        zio_register_buffer(test1, size);
     printf("%p\n", test1);
     printf("%p\n", test2);
     TEST_OP(memcpy(test2, test1, size));
@@ -8,6 +8,7 @@
 #include <sys/syscall.h>         /* Definition of SYS_* constants */
 #include <sys/socket.h>
 #include <string.h>
+#include <zio.h>
 #define SIZE (1024*4096)
 #define PAGE_SIZE 4096
 #define PAGE_BITS 12
@@ -78,7 +79,8 @@ int main(int argc, char *argv[])
     srand(0);
     printf("%p\n", test1);
     printf("%p\n", test2);
-    recv(-2, test1, size, 0xdeadbeef);
+    if (ZIO_AVAILABLE())
+        zio_register_buffer(test1, size);
     TEST_OP(memcpy(test2, test1, size));
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+/*
+ * Cost of resolving a userfaultfd missing fault the way page_fault_test.c
+ * and copy_interpose.c do it: mmap(MAP_FIXED | MAP_POPULATE) + memcpy +
+ * UFFDIO_WAKE, against a single UFFDIO_COPY that fills and wakes at once.
+ * Usage: fault_resolve [pages] [pages per fault]
+ */
+
+#define PAGE_SIZE 4096
+
+enum { MODE_MMAP, MODE_COPY };
+
+static long uffd;
+static int mode;
+static uint64_t region_start, region_len, chunk;
+static char *src;
+
+static void *handle_fault(void *arg)
+{
+  struct uffd_msg msg;
+  struct pollfd pollfd;
+
+  for (;;) {
+    pollfd.fd = uffd;
+    pollfd.events = POLLIN;
+    if (poll(&pollfd, 1, -1) < 0) {
+      perror("poll");
+      abort();
+    }
+    if (read(uffd, &msg, sizeof(msg)) != sizeof(msg)) {
+      if (errno == EAGAIN)
+        continue;
+      perror("read");
+      abort();
+    }
+    if (msg.event != UFFD_EVENT_PAGEFAULT)
+      continue;
+
+    uint64_t page = msg.arg.pagefault.address & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t len = chunk;
+    if (page + len > region_start + region_len)
+      len = region_start + region_len - page;
+    uint64_t off = page - region_start;
+
+    if (mode == MODE_COPY) {
+      struct uffdio_copy copy;
+      copy.dst = page;
+      copy.src = (uint64_t)(src + off);
+      copy.len = len;
+      copy.mode = 0;
+      if (ioctl(uffd, UFFDIO_COPY, &copy) < 0 && copy.copy != -EEXIST) {
+        perror("uffdio copy");
+        abort();
+      }
+    } else {
+      struct uffdio_range range;
+      mmap((void *)page, len, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+      memcpy((void *)page, src + off, len);
+      range.start = page;
+      range.len = PAGE_SIZE;
+      if (ioctl(uffd, UFFDIO_WAKE, &range) < 0) {
+        perror("uffdio wake");
+        abort();
+      }
+    }
+  }
+  return NULL;
+}
+
+static double run(uint64_t pages)
+{
+  struct uffdio_register reg;
+  struct timespec start, stop;
+  volatile char *dst;
+  uint64_t i, sum = 0;
+
+  dst = mmap(NULL, region_len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (dst == MAP_FAILED) {
+    perror("mmap");
+    abort();
+  }
+  region_start = (uint64_t)dst;
+
+  reg.range.start = region_start;
+  reg.range.len = region_len;
+  reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+  if (ioctl(uffd, UFFDIO_REGISTER, &reg) < 0) {
+    perror("uffdio register");
+    abort();
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < pages; i++)
+    sum += dst[i * PAGE_SIZE];
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  if (sum != pages * 'z') {
+    fprintf(stderr, "bad contents\n");
+    abort();
+  }
+  munmap((void *)dst, region_len);
+
+  return ((stop.tv_sec - start.tv_sec) * 1e9 +
+          (stop.tv_nsec - start.tv_nsec)) / ((pages + chunk / PAGE_SIZE - 1) /
+                                             (chunk / PAGE_SIZE));
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t pages = argc > 1 ? strtoull(argv[1], NULL, 0) : 16384;
+  uint64_t per_fault = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+  struct uffdio_api api;
+  pthread_t thread;
+
+  region_len = pages * PAGE_SIZE;
+  chunk = per_fault * PAGE_SIZE;
+  src = malloc(region_len);
+  memset(src, 'z', region_len);
+
+  uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+  if (uffd < 0) {
+    perror("userfaultfd");
+    return 1;
+  }
+  api.api = UFFD_API;
+  api.features = 0;
+  if (ioctl(uffd, UFFDIO_API, &api) < 0) {
+    perror("uffdio api");
+    return 1;
+  }
+  if (pthread_create(&thread, NULL, handle_fault, NULL) != 0) {
+    perror("pthread_create");
+    return 1;
+  }
+
+  mode = MODE_MMAP;
+  double t_mmap = run(pages);
+  mode = MODE_COPY;
+  double t_copy = run(pages);
+
+  printf("Pages: %lu\tPages/fault: %lu\tmmap+memcpy+wake: %.0f ns\t"
+         "uffdio_copy: %.0f ns\n", pages, per_fault, t_mmap, t_copy);
+  return 0;
+}
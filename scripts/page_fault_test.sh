@@ -68,6 +68,26 @@ LD_PRELOAD=../../tas/lib/page_fault_test.so ./echoserver_linux 12 8000 1 ./echos
 
 ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 4 ./testclient.conf 524288 >> results/page_fault_test/12fault_zio.dat"
 
+#The same zIO runs, but faults are resolved with a single UFFDIO_COPY instead of mmap + UFFDIO_WAKE.
+echo "zIO UFFDIO_COPY Runs"
+
+ZIO_FAULT_MODE=copy LD_PRELOAD=../../tas/lib/page_fault_test.so ./echoserver_linux 1 8000 1 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 4 ./testclient.conf 524288 >> results/page_fault_test/1fault_zio_copy.dat"
+
+ZIO_FAULT_MODE=copy LD_PRELOAD=../../tas/lib/page_fault_test.so ./echoserver_linux 4 8000 1 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 4 ./testclient.conf 524288 >> results/page_fault_test/4fault_zio_copy.dat"
+
+ZIO_FAULT_MODE=copy LD_PRELOAD=../../tas/lib/page_fault_test.so ./echoserver_linux 12 8000 1 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 4 ./testclient.conf 524288 >> results/page_fault_test/12fault_zio_copy.dat"
+
+#Local microbenchmark of the per fault cost of both resolution paths, with 1 and 16 pages filled per fault.
+echo "Local fault resolution"
+./fault_resolve 16384 1
+./fault_resolve 16384 16
+
 #After all the different server configurations are done, we run a simple script on the client machine to parse the output, cut the warmup period and get the average of the run. 
 
 echo "Processing..."
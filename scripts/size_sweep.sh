@@ -72,6 +72,27 @@ LD_PRELOAD=../../tas/lib/copy_interpose.so ./echoserver_linux 5 8000 1 ./echoser
 
 ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 $CLIENT_THREADS ./testclient.conf 262144 >> results/size_sweep/256KB_zio.dat"
 
+#Large copies from 2MB to 1GB, where zIO elides whole huge pages. Each connection buffers a full message,
+#so the servers only accept 4 connections and the client runs a single thread.
+echo "Large Runs"
+
+for SIZE_MB in 2 4 8 16 32 64 128 256 512 1024; do
+    SIZE=$((SIZE_MB * 1024 * 1024))
+
+    ./echoserver_linux 5 8000 1 ./echoserver.conf 4 $SIZE &
+
+    ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 60 ./testclient_linux 10.0.0.6 8000 1 ./testclient.conf $SIZE >> results/size_sweep/${SIZE_MB}MB.dat"
+
+    LD_PRELOAD=../../tas/lib/copy_interpose.so ./echoserver_linux 5 8000 1 ./echoserver.conf 4 $SIZE &
+
+    ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 60 ./testclient_linux 10.0.0.6 8000 1 ./testclient.conf $SIZE >> results/size_sweep/${SIZE_MB}MB_zio.dat"
+
+    #The same with huge page elision turned off, to see what it gains.
+    ZIO_HUGE=0 LD_PRELOAD=../../tas/lib/copy_interpose.so ./echoserver_linux 5 8000 1 ./echoserver.conf 4 $SIZE &
+
+    ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 60 ./testclient_linux 10.0.0.6 8000 1 ./testclient.conf $SIZE >> results/size_sweep/${SIZE_MB}MB_zio_nohuge.dat"
+done
+
 #After all the different server configurations are done, we run a simple script on the client machine to parse the output, cut the warmup period and get the average of the run. 
 
 echo "Processing..."
@@ -34,6 +34,18 @@ ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_li
 
 ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 32 ./testclient.conf 524288 >> results/thread_sweep/8thread.dat"
 
+./echoserver_linux 0 8000 12 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 48 ./testclient.conf 524288 >> results/thread_sweep/12thread.dat"
+
+./echoserver_linux 0 8000 16 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 64 ./testclient.conf 524288 >> results/thread_sweep/16thread.dat"
+
+./echoserver_linux 0 8000 24 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 96 ./testclient.conf 524288 >> results/thread_sweep/24thread.dat"
+
 #This section will have the zIO experiments.
 echo "zIO Runs"
 
@@ -54,6 +66,18 @@ LD_PRELOAD=../../copy_interpose.so ./echoserver_linux 0 8000 8 ./echoserver.conf
 
 ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 32 ./testclient.conf 524288 >> results/thread_sweep/8thread_zio.dat"
 
+LD_PRELOAD=../../copy_interpose.so ./echoserver_linux 0 8000 12 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 48 ./testclient.conf 524288 >> results/thread_sweep/12thread_zio.dat"
+
+LD_PRELOAD=../../copy_interpose.so ./echoserver_linux 0 8000 16 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 64 ./testclient.conf 524288 >> results/thread_sweep/16thread_zio.dat"
+
+LD_PRELOAD=../../copy_interpose.so ./echoserver_linux 0 8000 24 ./echoserver.conf 128 524288 &
+
+ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy; timeout 30 ./testclient_linux 10.0.0.6 8000 96 ./testclient.conf 524288 >> results/thread_sweep/24thread_zio.dat"
+
 #After all the different server configurations are done, we run a simple script on the client machine to parse the output, cut the warmup period and get the average of the run. 
 
 echo "Processing..."
@@ -63,3 +87,19 @@ ssh zio_ae@10.0.0.1 "cd zIO/benchmarks/micro_rpc_cpy/results/thread_sweep; ./pro
 scp 10.0.0.1:~/zIO/benchmarks/micro_rpc_cpy/results/thread_sweep/final.dat .
 cat final.dat
 rm final.dat
+
+#The network runs above use 0 copies. To show that copy elision itself scales, we also run the
+#copy_sweep microbenchmark locally: every thread receives into its own buffer and copies it
+#MAX_NUM_COPYS times, so with sharded tracking the copies/s should grow linearly with threads.
+#The command line options are the number of threads, the bytes per copy and the run time in seconds.
+echo "Local copy scaling"
+make copy_sweep
+mkdir -p results/thread_sweep_local/
+rm -f results/thread_sweep_local/*.dat
+
+for THREADS in 1 2 4 8 12 16 24; do
+    ./copy_sweep ${THREADS} 524288 10 >> results/thread_sweep_local/${THREADS}thread.dat
+    LD_PRELOAD=../../copy_interpose.so ./copy_sweep ${THREADS} 524288 10 >> results/thread_sweep_local/${THREADS}thread_zio.dat
+done
+
+grep -H Throughput results/thread_sweep_local/*.dat
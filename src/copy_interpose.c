@@ -32,9 +32,13 @@
 #define __USE_GNU
 #include <assert.h>
 #include <dlfcn.h>
+#include <malloc.h>
 #include <execinfo.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/errqueue.h>
 #include <linux/userfaultfd.h>
+#include <netinet/in.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
@@ -49,6 +53,10 @@
 #include <tas_sockets.h>
 #include <unistd.h>
 #include <utils.h>
+#include <utils_sync.h>
+#define ZIO_INTERPOSER
+#include <zio.h>
+#include <zio_stats.h>
 
 //#define OPT_THRESHOLD 0xfffffffffffffffff
 // #define OPT_THRESHOLD 1048575
@@ -57,7 +65,8 @@
 #define PAGE_SIZE sysconf(_SC_PAGE_SIZE)
 #define PAGE_MASK ~(PAGE_SIZE - 1) // 0xfffffffff000
 
-#define MAX_UFFD_MSGS 1
+#define MAX_UFFD_MSGS 64
+#define MAX_FAULT_THREADS 64
 
 #define UFFD_PROTO
 
@@ -123,47 +132,262 @@
     }                                                                          \
   } while (0)
 
-#define copy_from_original(orig_addr)                                          \
-  do {                                                                         \
-    LOG("[%s] the original buffer %p exists\n", __func__, orig_addr);       \
-    snode *entry = skiplist_front(&addr_list);                                 \
-    while (entry) {                                                            \
-      snode *entry_to_be_deleted = 0;                                          \
-      if (entry->orig != entry->addr &&                                        \
-          PAGE_ALIGN_DOWN(orig_addr) == PAGE_ALIGN_DOWN(entry->orig)) {        \
-        mmap((void*)(entry->addr + entry->offset), entry->len,                 \
-            PROT_READ | PROT_WRITE,                                            \
-            MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);    \
-        libc_memcpy((void *)(entry->addr + entry->offset),                     \
-                    (void *)(entry->orig + entry->offset), entry->len);        \
-                                                                               \
-        LOG("[%s] copy from %p-%p to %p-%p, len: %lu\n", __func__,             \
-               entry->orig + entry->offset,                                    \
-               entry->orig + entry->offset + entry->len,                       \
-               entry->addr + entry->offset,                                    \
-               entry->addr + entry->offset + entry->len, entry->len);          \
-                                                                               \
-        entry_to_be_deleted = entry;                                           \
-      }                                                                        \
-      entry = snode_get_next(&addr_list, entry);                               \
-      if (entry_to_be_deleted)                                                 \
-        skiplist_delete(&addr_list, entry_to_be_deleted->lookup);                      \
-    }                                                                          \
-  } while (0)
+/*
+ * Tracking state is partitioned into address-range shards so that threads
+ * eliding copies on disjoint buffers never share a lock or a skiplist.
+ *
+ * Synchronisation protocol:
+ *  - A tracking entry never straddles a ZIO_SHARD_SIZE boundary (see
+ *    track_insert_locked()), so the entry covering an address always lives in
+ *    the shard of that address.
+ *  - Entries of a shard are only read or modified with the shard lock held.
+ *  - Nothing under a shard lock writes to memory the application may have
+ *    handed to zIO: nodes are allocated before and freed after the critical
+ *    section, since malloc may reuse pages that are write-protected or
+ *    registered for missing faults.
+ *  - Threads holding several shard locks acquire them in ascending index
+ *    order through shards_lock().
+ *  - The fault handler and handle_existing_buffer() hold at most one shard
+ *    lock at a time.
+ *  - No shard lock is held across a syscall that may block. Senders resolve
+ *    the range being sent under its shard locks and pin the originals it
+ *    references in zc_sends[] before releasing them. A write to an original
+ *    waits in copy_from_original() until every in-flight send that
+ *    references it has returned; a write fault on it is deferred by the
+ *    fault thread instead, which keeps resolving missing faults meanwhile.
+ *    Pinned sends to pipes and sockets never wait for the peer, see
+ *    send_resolved().
+ */
+#define ZIO_SHARD_SHIFT 21
+#define ZIO_SHARD_SIZE (1ULL << ZIO_SHARD_SHIFT)
+#define ZIO_NUM_SHARDS 64
+STATIC_ASSERT(ZIO_NUM_SHARDS <= 64, shard_mask_fits_u64);
+
+#define SHARD_BASE(addr) ((uint64_t)(addr) & ~(ZIO_SHARD_SIZE - 1))
+#define SHARD_IDX(addr) (((uint64_t)(addr) >> ZIO_SHARD_SHIFT) % ZIO_NUM_SHARDS)
+#define SHARD_LIST(addr) (&shards[SHARD_IDX(addr)].list)
+
+/*
+ * Copies of at least a huge page are elided at huge page granularity where
+ * the destination covers whole aligned huge pages: each such piece is a
+ * single entry (shard granules are huge pages, see track_insert_locked())
+ * and its first fault remaps and fills the whole huge page. The unaligned
+ * head and tail are tracked in base pages as before.
+ */
+#define HUGE_PAGE_SIZE (2ULL << 20)
+STATIC_ASSERT(HUGE_PAGE_SIZE == ZIO_SHARD_SIZE, huge_pages_are_granules);
 
-#define IOV_MAX_CNT 10000
+struct addr_shard {
+  pthread_mutex_t mu;
+  skiplist list;
+} __attribute__((aligned(64)));
+
+/*
+ * Reverse index from original memory to the copies aliasing it, so that a
+ * write to an original only visits its own copies. Copies are hashed by the
+ * ZIO_SHARD_SIZE granules of their original range; a tracked piece is at
+ * most one granule long, so it is linked into at most two buckets through
+ * the ridx links embedded in its snode. Bucket locks nest inside shard locks
+ * and are never held while acquiring a shard lock.
+ */
+#define RIDX_BITS 12
+#define RIDX_BUCKETS (1 << RIDX_BITS)
+#define RIDX_BATCH 64
+#define RIDX_BUCKET(orig)                                                      \
+  ((uint32_t)((((uint64_t)(orig) >> ZIO_SHARD_SHIFT) * 0x9e3779b97f4a7c15ULL) \
+              >> (64 - RIDX_BITS)))
+
+struct ridx_bucket {
+  volatile uint32_t lock;
+  struct ridx_link *head;
+} __attribute__((aligned(64)));
 
 long uffd = -1;
 
-pthread_t fault_thread, stats_thread;
+pthread_t fault_threads[MAX_FAULT_THREADS], stats_thread;
+int num_fault_threads = 1;
+// CPUs the fault threads are pinned to, round robin, from ZIO_FAULT_CPUS
+int fault_cpus[MAX_FAULT_THREADS];
+int num_fault_cpus;
 
-pthread_mutex_t mu;
+/* How missing pages of a copy are filled in, from ZIO_FAULT_MODE. UFFDIO_COPY
+ * installs the pages and wakes the faulting threads in one call and keeps the
+ * VMA intact; mmap replaces the range with a fresh populated mapping, copies
+ * into it and needs a separate UFFDIO_WAKE. */
+enum fault_mode { FAULT_MODE_COPY = 0, FAULT_MODE_MMAP = 1 };
+int fault_mode = FAULT_MODE_COPY;
+
+/*
+ * Elision cost model. Each memcpy call site (return address) and log2 size
+ * class gets a slot counting the pages it elided and the pages of those
+ * copies that were later faulted or materialised back in. A slot whose fault
+ * rate exceeds elide_max_fault_pct stops eliding, except for one probe every
+ * elide_probe calls so that it can recover when the access pattern changes.
+ * Slot 0 collects entries without a call site and overflow.
+ */
+#define ELIDE_SITE_BITS ZIO_STATS_SITE_BITS
+#define ELIDE_SITES ZIO_STATS_SITES
+
+// tunables, see parse_elide_config()
+uint64_t elide_min = OPT_THRESHOLD + 1;
+uint64_t elide_max_fault_pct = 50;
+uint64_t elide_warmup_pages = 256;
+uint64_t elide_window_pages = 65536;
+uint64_t elide_probe = 64;
+
+/* Application control through zio.h. Once a region has been begun, or with
+ * ZIO_REGIONS=1, copies are only elided inside regions of the copying
+ * thread. Copies from ranges hinted read-only bypass the cost model. */
+int elide_regions;
+static __thread int region_depth;
+
+// realloc() growth of at least this many bytes moves pages instead of
+// copying, from ZIO_REALLOC_REMAP_MIN
+uint64_t realloc_remap_min = 1ULL << 20;
+
+/* Sends referencing originals. Every send of the originals of elided copies
+ * holds a pending slot until its syscall returns. With ZIO_ZEROCOPY=1, parts
+ * of at least zerocopy_min bytes of a send to a stream socket that come from
+ * originals are handed to the kernel without it copying them, and their slot
+ * stays busy until the completion of the send arrives on the socket's error
+ * queue. The originals are write protected, so copy_from_original() waits
+ * for the slots overlapping them before a write, free or unmap may proceed. */
+#define ZC_MAX_FDS 4096
+#define ZC_INFLIGHT 256
+enum zc_state { ZC_UNKNOWN = 0, ZC_ON = 1, ZC_OFF = 2 };
+struct zc_send {
+  int fd;
+  uint32_t seq;     // kernel sequence number of the send on fd
+  uint8_t busy;
+  uint8_t pending;  // reserved, sendmsg() not returned yet
+  uint64_t start, end; // originals the send may reference
+};
+int zerocopy;
+uint64_t zerocopy_min = 16384;
+uint8_t zc_state[ZC_MAX_FDS];
+uint32_t zc_next_seq[ZC_MAX_FDS];
+struct zc_send zc_sends[ZC_INFLIGHT];
+uint32_t zc_inflight;
+volatile uint32_t zc_lock;
+
+#define READONLY_HINTS 64
+struct readonly_hint {
+  uint64_t start, end;
+};
+struct readonly_hint readonly_hints[READONLY_HINTS];
+uint32_t num_readonly_hints;
+volatile uint32_t readonly_hints_lock;
+
+/* Fault-around: a fault on a copy that continues a forward stream of faults
+ * with a constant stride resolves the next pages of the stream as well. The
+ * window doubles with every fault that continues the stream, up to
+ * fault_around_max pages, and drops back to a single page otherwise. */
+uint64_t fault_around_max = 32;
+uint64_t fault_around_max_stride = 4;
+
+// whether copies at equal page offsets move the source pages, from ZIO_REMAP
+int remap_elide;
+
+// whether transparent huge pages may back elided copies, see
+// parse_elide_config()
+int huge_elide;
+
+struct addr_shard shards[ZIO_NUM_SHARDS];
+struct ridx_bucket ridx_buckets[RIDX_BUCKETS];
+
+/* Statistics, see zio_stats.h. They live in a static struct until init()
+ * has mapped the shared memory segment that zio-stat reads, or for good if
+ * that fails or ZIO_STATS=0. */
+struct zio_stats zio_stats_boot;
+struct zio_stats *zstats = &zio_stats_boot;
+char zio_stats_name[64];
+
+static __thread struct zio_thread_stats *thread_stats_slot;
+static __thread struct zio_stats *thread_stats_owner;
+static pthread_once_t thread_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_stats_key;
 
 static inline void ensure_init(void);
 
-uint64_t num_fast_writes, num_slow_writes, num_fast_copy, num_slow_copy,
-    num_faults;
-uint64_t time_search, time_insert, time_other;
+static void thread_stats_release(void *arg) {
+  struct zio_thread_stats *s = (struct zio_thread_stats *)arg;
+  // the counts stay, the next thread to claim the slot adds to them
+  __atomic_store_n(&s->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void thread_stats_key_init(void) {
+  pthread_key_create(&thread_stats_key, thread_stats_release);
+}
+
+static struct zio_thread_stats *thread_stats_claim(void) {
+  struct zio_stats *st = zstats;
+  struct zio_thread_stats *s;
+  int i;
+
+  for (i = 0; i < ZIO_STATS_MAX_THREADS - 1; i++) {
+    uint32_t free_slot = 0;
+    s = &st->threads[i];
+    if (__atomic_compare_exchange_n(&s->in_use, &free_slot, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+  s = &st->threads[i];
+  if (i < ZIO_STATS_MAX_THREADS - 1) {
+    s->tid = syscall(SYS_gettid);
+    pthread_once(&thread_stats_once, thread_stats_key_init);
+    pthread_setspecific(thread_stats_key, s);
+  }
+  // else all threads beyond the limit share the last slot and their counts
+  // are approximate
+  thread_stats_slot = s;
+  thread_stats_owner = st;
+  return s;
+}
+
+static inline struct zio_thread_stats *thread_stats(void) {
+  if (thread_stats_owner != zstats)
+    return thread_stats_claim();
+  return thread_stats_slot;
+}
+
+// only the owning thread writes its slot, readers may see a stale value
+#define STAT_ADD(field, v)                                                     \
+  do {                                                                         \
+    struct zio_thread_stats *s_ = thread_stats();                              \
+    __atomic_store_n(&s_->field, s_->field + (v), __ATOMIC_RELAXED);           \
+  } while (0)
+
+static inline void stats_track(int64_t entries, int64_t bytes) {
+  __atomic_fetch_add(&zstats->tracked_entries, entries, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&zstats->original_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static void stats_sum(struct zio_thread_stats *t) {
+  int i, k, b;
+
+  memset(t, 0, sizeof(*t));
+  for (i = 0; i < ZIO_STATS_MAX_THREADS; i++) {
+    const struct zio_thread_stats *s = &zstats->threads[i];
+    t->fast_copies += s->fast_copies;
+    t->elided_bytes += s->elided_bytes;
+    t->slow_copies += s->slow_copies;
+    t->fast_writes += s->fast_writes;
+    t->slow_writes += s->slow_writes;
+    t->faults += s->faults;
+    t->fault_around_pages += s->fault_around_pages;
+    t->huge_faults += s->huge_faults;
+    t->moved_bytes += s->moved_bytes;
+    t->remapped_bytes += s->remapped_bytes;
+    t->zerocopy_sends += s->zerocopy_sends;
+    t->zerocopy_copied += s->zerocopy_copied;
+    t->time_search += s->time_search;
+    t->time_insert += s->time_insert;
+    t->time_other += s->time_other;
+    for (k = 0; k < ZIO_FAULT_KINDS; k++)
+      for (b = 0; b < ZIO_STATS_HIST_BUCKETS; b++)
+        t->fault_hist[k][b] += s->fault_hist[k][b];
+  }
+}
 
 static void *(*libc_memcpy)(void *dest, const void *src, size_t n);
 static void *(*libc_memmove)(void *dest, const void *src, size_t n);
@@ -172,15 +396,904 @@ static ssize_t (*libc_pwrite)(int fd, const void *buf, size_t count,
 static ssize_t (*libc_pwritev)(int sockfd, const struct iovec *iov, int iovcnt,
                                off_t offset) = NULL;
 static void *(*libc_realloc)(void *ptr, size_t new_size);
-//static void (*libc_free)(void *ptr);
+// glibc's own entry point, usable before libc_realloc is bound
+#ifdef __cplusplus
+extern "C"
+#endif
+void *__libc_realloc(void *ptr, size_t new_size);
+#ifdef __cplusplus
+extern "C"
+#endif
+void __libc_free(void *ptr);
+static void (*libc_free)(void *ptr);
+static int (*libc_munmap)(void *addr, size_t len);
+static int (*libc_madvise)(void *addr, size_t len, int advice);
+static int (*libc_close)(int fd);
 static ssize_t (*libc_send)(int sockfd, const void *buf, size_t count,
                             int flags);
 static ssize_t (*libc_sendmsg)(int sockfd, const struct msghdr *msg, int flags);
 
 static ssize_t (*libc_recv)(int sockfd, void *buf, size_t len, int flags);
 static ssize_t (*libc_recvmsg)(int sockfd, struct msghdr *msg, int flags);
+static ssize_t (*libc_write)(int fd, const void *buf, size_t count);
+static ssize_t (*libc_sendto)(int sockfd, const void *buf, size_t count,
+                              int flags, const struct sockaddr *addr,
+                              socklen_t addrlen);
+static ssize_t (*libc_writev)(int fd, const struct iovec *iov, int iovcnt);
+
+/* Bitmask of the shards covering [start, start + len) */
+static inline uint64_t shard_mask(uint64_t start, uint64_t len) {
+  uint64_t mask = 0;
+  uint64_t base;
+
+  if (len >= ZIO_NUM_SHARDS * ZIO_SHARD_SIZE)
+    return ~0ULL;
+
+  for (base = SHARD_BASE(start); base < start + len; base += ZIO_SHARD_SIZE)
+    mask |= 1ULL << SHARD_IDX(base);
+  return mask;
+}
+
+static inline void shards_lock(uint64_t mask) {
+  while (mask) {
+    int i = __builtin_ctzll(mask);
+    pthread_mutex_lock(&shards[i].mu);
+    mask &= mask - 1;
+  }
+}
+
+static inline void shards_unlock(uint64_t mask) {
+  while (mask) {
+    int i = __builtin_ctzll(mask);
+    pthread_mutex_unlock(&shards[i].mu);
+    mask &= mask - 1;
+  }
+}
+
+static inline void ridx_link_add(snode *x, int slot, uint64_t orig) {
+  struct ridx_link *l = &x->ridx[slot];
+  struct ridx_bucket *b = &ridx_buckets[RIDX_BUCKET(orig)];
+
+  l->node = x;
+  l->bucket = RIDX_BUCKET(orig);
+  util_spin_lock(&b->lock);
+  l->next = b->head;
+  if (l->next)
+    l->next->pprev = &l->next;
+  l->pprev = &b->head;
+  b->head = l;
+  util_spin_unlock(&b->lock);
+}
+
+/* Add a tracked copy to the reverse index. Caller holds its shard lock. */
+static void ridx_add(snode *x) {
+  uint64_t orig_start = x->orig + x->offset;
+  uint64_t orig_last = orig_start + x->len - 1;
+
+  if (x->orig == x->addr || x->len == 0)
+    return;
+
+  ridx_link_add(x, 0, orig_start);
+  if (SHARD_BASE(orig_last) != SHARD_BASE(orig_start))
+    ridx_link_add(x, 1, orig_last);
+}
+
+/* Drop x from the reverse index. Caller holds its shard lock. */
+static void ridx_del(snode *x) {
+  int slot;
+
+  for (slot = 0; slot < 2; slot++) {
+    struct ridx_link *l = &x->ridx[slot];
+    struct ridx_bucket *b;
+
+    if (!l->pprev)
+      continue;
+    b = &ridx_buckets[l->bucket];
+    util_spin_lock(&b->lock);
+    *l->pprev = l->next;
+    if (l->next)
+      l->next->pprev = l->pprev;
+    util_spin_unlock(&b->lock);
+    l->pprev = NULL;
+  }
+}
+
+/* Unlink the entry keyed lookup from its shard list and the reverse index.
+ * Caller holds the shard lock and frees the node after dropping it. */
+static inline snode *track_unlink_locked(skiplist *list, uint64_t lookup) {
+  snode *x = skiplist_unlink(list, lookup);
+  if (x) {
+    ridx_del(x);
+    stats_track(-1, -(int64_t)x->len);
+  }
+  return x;
+}
+
+/* Counterpart of track_unlink_locked(), caller holds the shard lock and has
+ * taken out whatever overlapped x */
+static inline void track_link_locked(skiplist *list, snode *x) {
+  if (skiplist_insert_node(list, x)) {
+    fprintf(stderr, "zIO: %p is tracked twice\n", (void *)x->lookup);
+    abort();
+  }
+  ridx_add(x);
+  stats_track(1, x->len);
+}
+
+/* Allocate one node per shard piece of [start, start + len), and one for
+ * cutting an entry that reaches beyond it, chained through forward[0] */
+static snode *track_alloc_pieces(uint64_t start, uint64_t len) {
+  snode *chain = skiplist_node_alloc();
+  uint64_t base;
+
+  chain->forward[0] = NULL;
+  for (base = SHARD_BASE(start); base < start + len; base += ZIO_SHARD_SIZE) {
+    snode *x = skiplist_node_alloc();
+    x->forward[0] = chain;
+    chain = x;
+  }
+  return chain;
+}
+
+static snode *track_cut_locked(skiplist *list, snode *x, uint64_t start,
+                               uint64_t end, uint64_t min_len, snode **spare,
+                               uint64_t *rstart, uint64_t *rend);
+static snode *copy_cut_locked(skiplist *list, snode *x, uint64_t start,
+                              uint64_t end, int keep_contents, snode **spare);
+
+/* Insert entry, split at shard boundaries, taking nodes from *spare. What the
+ * core buffer held is taken out first: the pages of copies in it get their
+ * contents if entry is an original and are dropped if it is a copy, and
+ * originals in it are cut, their copies having been resolved by the caller.
+ * Caller holds the shard locks covering the core buffer and frees what is
+ * left in *spare after dropping them. */
+static void track_insert_locked(const snode *entry, snode **spare) {
+  const int original = entry->orig == entry->addr;
+  uint64_t core = entry->addr + entry->offset;
+  uint64_t start = core;
+  uint64_t end = core + entry->len;
+
+  while (start < end) {
+    uint64_t piece_end = MIN(end, SHARD_BASE(start) + ZIO_SHARD_SIZE);
+    uint64_t delta = start - core;
+    skiplist *list = SHARD_LIST(start);
+    snode *x, *old;
+
+    while ((old = skiplist_search_overlap(list, start, piece_end))) {
+      snode *cut = *spare;
+      uint64_t rs, re;
+
+      *spare = cut->forward[0];
+      if (old->orig != old->addr)
+        old = copy_cut_locked(list, old, start, piece_end, original, &cut);
+      else
+        old = track_cut_locked(list, old, MAX(start, old->lookup),
+                               MIN(piece_end, old->lookup + old->len), 0,
+                               &cut, &rs, &re);
+      if (cut) {
+        cut->forward[0] = *spare;
+        *spare = cut;
+      }
+      if (old) {
+        old->forward[0] = *spare;
+        *spare = old;
+      }
+    }
+
+    x = *spare;
+    *spare = x->forward[0];
+    x->lookup = start;
+    x->orig = entry->orig + delta;
+    x->addr = entry->addr + delta;
+    x->len = piece_end - start;
+    x->offset = entry->offset;
+    x->site = entry->site;
+    x->huge = entry->huge && start == SHARD_BASE(start) &&
+              x->len == HUGE_PAGE_SIZE;
+    x->ra_last = 0;
+    x->ra_stride = x->ra_pages = 0;
+    track_link_locked(list, x);
+    start = piece_end;
+  }
+}
+
+static void track_insert(const snode *entry) {
+  uint64_t core = entry->addr + entry->offset;
+  uint64_t mask = shard_mask(core, entry->len);
+  snode *spare = track_alloc_pieces(core, entry->len);
+
+  shards_lock(mask);
+  track_insert_locked(entry, &spare);
+  shards_unlock(mask);
+  skiplist_node_chain_free(spare);
+}
+
+/* Merge the entry starting at lookup into the entry ending right before it
+ * if their originals are contiguous too, so that streaming receives and
+ * copies keep one entry per buffer rather than one per call. Originals also
+ * merge across the page two buffers share, which only needs to be write
+ * protected along with them. Entries stay within their granule; cutting
+ * pages out of a merged entry splits it again, see track_cut_locked().
+ * Caller holds the shard lock of lookup. Returns the node to free after
+ * dropping the lock. */
+static snode *track_coalesce_locked(uint64_t lookup) {
+  skiplist *list = SHARD_LIST(lookup);
+  snode *x = skiplist_search(list, lookup);
+  snode *prev;
+  uint64_t gap;
+
+  if (!x || x->huge || lookup == SHARD_BASE(lookup))
+    return NULL;
+  prev = skiplist_search_buffer_fallin(list, lookup - 1);
+  gap = 0;
+  if (!prev && x->orig == x->addr && lookup - PAGE_SIZE != SHARD_BASE(lookup)) {
+    prev = skiplist_search_buffer_fallin(list, lookup - PAGE_SIZE - 1);
+    gap = PAGE_SIZE;
+  }
+  if (!prev || prev->huge ||
+      prev->addr + prev->offset + prev->len + gap != lookup ||
+      prev->orig - prev->addr != x->orig - x->addr || prev->site != x->site ||
+      (gap && prev->orig != prev->addr))
+    return NULL;
+
+  LOG("[%s] %p-%p merged into %p-%p\n", __func__, lookup, lookup + x->len,
+      prev->lookup, prev->lookup + prev->len);
+  x = track_unlink_locked(list, lookup);
+  prev = track_unlink_locked(list, prev->lookup);
+  prev->len += gap + x->len;
+  track_link_locked(list, prev);
+  return x;
+}
+
+/* Look up the entry starting at lookup and extend it over the pieces that
+ * track_insert_locked() split off into the following shards. The result is a
+ * snapshot, the shard locks are not held on return. */
+static int track_search(uint64_t lookup, snode *out) {
+  struct addr_shard *shard = &shards[SHARD_IDX(lookup)];
+  snode *x;
+
+  pthread_mutex_lock(&shard->mu);
+  x = skiplist_search(&shard->list, lookup);
+  if (x)
+    *out = *x;
+  pthread_mutex_unlock(&shard->mu);
+  if (!x)
+    return 0;
+
+  for (;;) {
+    uint64_t next = out->addr + out->offset + out->len;
+    if (next != SHARD_BASE(next))
+      break;
+
+    shard = &shards[SHARD_IDX(next)];
+    pthread_mutex_lock(&shard->mu);
+    x = skiplist_search(&shard->list, next);
+    if (x && x->orig - x->addr == out->orig - out->addr)
+      out->len += x->len;
+    else
+      x = NULL;
+    pthread_mutex_unlock(&shard->mu);
+    if (!x)
+      break;
+  }
+  return 1;
+}
+
+/* track_search() of the entry whose core buffer holds addr, which after
+ * coalescing need not start there */
+static int track_search_holding(uint64_t addr, snode *out) {
+  struct addr_shard *shard = &shards[SHARD_IDX(addr)];
+  uint64_t lookup = 0;
+  snode *x;
+
+  pthread_mutex_lock(&shard->mu);
+  x = skiplist_search_buffer_fallin(&shard->list, addr);
+  if (x)
+    lookup = x->lookup;
+  pthread_mutex_unlock(&shard->mu);
+  return x && track_search(lookup, out);
+}
+
+/* Snapshot the next entry whose core buffer overlaps [*cursor, end) and move
+ * *cursor past it. The shard lock is not held on return. */
+static int track_next_overlap(uint64_t *cursor, uint64_t end, snode *out) {
+  while (*cursor < end) {
+    uint64_t granule_end = MIN(end, SHARD_BASE(*cursor) + ZIO_SHARD_SIZE);
+    struct addr_shard *shard = &shards[SHARD_IDX(*cursor)];
+    snode *x;
+
+    pthread_mutex_lock(&shard->mu);
+    x = skiplist_search_overlap(&shard->list, *cursor, granule_end);
+    if (x)
+      *out = *x;
+    pthread_mutex_unlock(&shard->mu);
+    if (x) {
+      *cursor = out->addr + out->offset + out->len;
+      return 1;
+    }
+    *cursor = granule_end;
+  }
+  return 0;
+}
+
+static int readonly_hinted(uint64_t start, uint64_t len) {
+  uint32_t i, n = __atomic_load_n(&num_readonly_hints, __ATOMIC_ACQUIRE);
+
+  for (i = 0; i < n; i++) {
+    struct readonly_hint *h = &readonly_hints[i];
+    if (h->start <= start && start + len <= h->end)
+      return 1;
+  }
+  return 0;
+}
+
+/* Cost model slot of a copy of n bytes at call site site, 0 if none is free */
+static uint32_t elide_site_slot(const void *site, size_t n) {
+  uint64_t key = ((uint64_t)site << 6) | (63 - __builtin_clzll(n));
+  uint32_t slot = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >>
+                             (64 - ELIDE_SITE_BITS));
+  int i;
+
+  for (i = 0; i < 16; i++, slot = (slot + 1) & (ELIDE_SITES - 1)) {
+    uint64_t cur;
+    if (slot == 0)
+      continue;
+    cur = __atomic_load_n(&zstats->sites[slot].key, __ATOMIC_RELAXED);
+    if (cur == key)
+      return slot;
+    if (cur == 0 &&
+        __atomic_compare_exchange_n(&zstats->sites[slot].key, &cur, key, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return slot;
+    // lost the race, possibly to the same key
+    if (cur == key)
+      return slot;
+  }
+  return 0;
+}
+
+/* Whether a copy from this slot should be elided. */
+static int elide_should(uint32_t slot) {
+  struct zio_site_stats *e = &zstats->sites[slot];
+  uint64_t elided = e->elided_pages;
+  uint64_t calls = __atomic_fetch_add(&e->calls, 1, __ATOMIC_RELAXED);
+
+  if (elided < elide_warmup_pages ||
+      e->faulted_pages * 100 <= elided * elide_max_fault_pct)
+    return 1;
+  if (elide_probe && calls % elide_probe == 0)
+    return 1;
+  __atomic_fetch_add(&e->skipped, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+static void elide_account(uint32_t slot, uint64_t elided, uint64_t faulted) {
+  struct zio_site_stats *e = &zstats->sites[slot];
+
+  if (elided &&
+      __atomic_add_fetch(&e->elided_pages, elided, __ATOMIC_RELAXED) >
+          elide_window_pages) {
+    // decay so that old behaviour is forgotten, racy but only approximate
+    e->elided_pages /= 2;
+    e->faulted_pages /= 2;
+  }
+  if (faulted)
+    __atomic_fetch_add(&e->faulted_pages, faulted, __ATOMIC_RELAXED);
+}
+
+/* Fill the missing pages [dst, dst + len) of a registered copy from src.
+ * Returns whether everyone faulting on them has been woken as well. */
+static int resolve_range(uint64_t dst, uint64_t src, uint64_t len) {
+  while (fault_mode == FAULT_MODE_COPY && len > 0) {
+    struct uffdio_copy copy;
+    copy.dst = dst;
+    copy.src = src;
+    copy.len = len;
+    copy.mode = 0;
+    if (ioctl(uffd, UFFDIO_COPY, &copy) == 0)
+      return 1;
+
+    if (copy.copy > 0) {
+      dst += copy.copy;
+      src += copy.copy;
+      len -= copy.copy;
+    } else if (copy.copy == -EEXIST) {
+      // already filled in by someone else, just make sure it is woken
+      struct uffdio_range range;
+      range.start = dst;
+      range.len = PAGE_SIZE;
+      ioctl(uffd, UFFDIO_WAKE, &range);
+      dst += PAGE_SIZE;
+      src += PAGE_SIZE;
+      len -= PAGE_SIZE;
+    } else if (copy.copy != -EAGAIN) {
+      // not registered with this uffd anymore, fall back to remapping
+      LOG("[%s] uffdio copy failed: %lld\n", __func__, copy.copy);
+      break;
+    }
+  }
+  if (len == 0)
+    return 1;
 
-skiplist addr_list;
+  mmap((void *)dst, len, PROT_READ | PROT_WRITE,
+       MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  libc_memcpy((void *)dst, (void *)src, len);
+  return 0;
+}
+
+/* Fill a whole huge page of a copy. UFFDIO_COPY would only install base
+ * pages, so the range is remapped as a transparent huge page instead. */
+static int resolve_huge(uint64_t dst, uint64_t src, uint64_t len) {
+  mmap((void *)dst, len, PROT_READ | PROT_WRITE,
+       MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
+  madvise((void *)dst, len, MADV_HUGEPAGE);
+  libc_memcpy((void *)dst, (void *)src, len);
+  return 0;
+}
+
+/* Take pages [start, end) out of entry x, which the caller has locked in
+ * list. The parts of x left and right of them stay tracked, unless they are
+ * min_len bytes or less: those are taken out as well, and [*rstart, *rend)
+ * is widened to cover them. *spare becomes the right part and is set to NULL
+ * if one is needed. Returns x if nothing of it is tracked anymore, for the
+ * caller to free after dropping the lock. */
+static snode *track_cut_locked(skiplist *list, snode *x, uint64_t start,
+                               uint64_t end, uint64_t min_len, snode **spare,
+                               uint64_t *rstart, uint64_t *rend) {
+  const uint64_t core = x->addr + x->offset;
+  const uint64_t core_end = core + x->len;
+  uint64_t left = start - core;
+  uint64_t right = core_end - end;
+
+  if (left <= min_len) {
+    start = core;
+    left = 0;
+  }
+  if (right <= min_len) {
+    end = core_end;
+    right = 0;
+  }
+  *rstart = start;
+  *rend = end;
+
+  if (right) {
+    snode *r = *spare;
+    *spare = NULL;
+    r->lookup = end;
+    r->addr = end;
+    r->offset = 0;
+    r->orig = x->orig + (end - x->addr);
+    r->len = right;
+    r->site = x->site;
+    r->huge = 0;
+    // a stream of faults continues in the right part
+    r->ra_last = x->ra_last;
+    r->ra_stride = x->ra_stride;
+    r->ra_pages = x->ra_pages;
+    track_link_locked(list, r);
+  }
+  if (left) {
+    stats_track(0, -(int64_t)(x->len - left));
+    x->len = left;
+    x->huge = 0;
+    return NULL;
+  }
+  return track_unlink_locked(list, x->lookup);
+}
+
+/* Stop tracking the pages of copy x that hold bytes of [start, end). With
+ * keep_contents they get their contents from the original; without, only
+ * pages reaching beyond [start, end) do and the rest, about to be overwritten
+ * or freed, is replaced by fresh zero pages. Those are no longer registered
+ * with userfaultfd, which no tracking entry would resolve a fault of anymore.
+ * Returns x if it is gone, see track_cut_locked(). */
+static snode *copy_cut_locked(skiplist *list, snode *x, uint64_t start,
+                              uint64_t end, int keep_contents,
+                              snode **spare) {
+  const uint64_t core = x->addr + x->offset;
+  const uint64_t delta = x->orig - x->addr;
+  const uint32_t site = x->site;
+  const int huge = x->huge;
+  uint64_t lo = MAX(core, start & PAGE_MASK);
+  uint64_t hi = MIN(core + x->len, (end + PAGE_SIZE - 1) & PAGE_MASK);
+  uint64_t drop_lo = (start + PAGE_SIZE - 1) & PAGE_MASK;
+  uint64_t drop_hi = end & PAGE_MASK;
+  uint64_t rs, re;
+  snode *dead;
+
+  // a huge page is resolved as a whole
+  if (huge) {
+    lo = core;
+    hi = core + x->len;
+  }
+  dead = track_cut_locked(list, x, lo, hi, OPT_THRESHOLD, spare, &rs, &re);
+
+  if (keep_contents || drop_lo >= drop_hi)
+    drop_lo = drop_hi = re;
+  drop_lo = MIN(MAX(drop_lo, rs), re);
+  drop_hi = MIN(MAX(drop_hi, drop_lo), re);
+  if (huge && (drop_lo != rs || drop_hi != re)) {
+    resolve_huge(rs, rs + delta, re - rs);
+    drop_lo = drop_hi;
+  } else if (!huge) {
+    if (drop_lo > rs)
+      resolve_range(rs, rs + delta, drop_lo - rs);
+    if (re > drop_hi)
+      resolve_range(drop_hi, drop_hi + delta, re - drop_hi);
+  }
+  if (drop_hi > drop_lo)
+    mmap((void *)drop_lo, drop_hi - drop_lo, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
+  if (re - rs > drop_hi - drop_lo)
+    elide_account(site, 0, (re - rs - (drop_hi - drop_lo)) / PAGE_SIZE);
+  return dead;
+}
+
+/* Whether fd is a stream socket with SO_ZEROCOPY set, enabling it on first
+ * use. Sends are split into zerocopy and ordinary parts, which only
+ * preserves the message boundaries of a stream. */
+static int zc_enable(int fd) {
+  int one = 1, type;
+  socklen_t len = sizeof(type);
+
+  if (fd < 0 || fd >= ZC_MAX_FDS)
+    return 0;
+  if (zc_state[fd] == ZC_UNKNOWN)
+    zc_state[fd] =
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 &&
+                type == SOCK_STREAM &&
+                setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+                           sizeof(one)) == 0
+            ? ZC_ON
+            : ZC_OFF;
+  return zc_state[fd] == ZC_ON;
+}
+
+/* Reserve a slot for a send on fd referencing originals [start, end), -1 if
+ * all are in flight and the send has to be copied. */
+static int zc_reserve(int fd, uint64_t start, uint64_t end) {
+  int i;
+
+  util_spin_lock(&zc_lock);
+  for (i = 0; i < ZC_INFLIGHT; i++) {
+    struct zc_send *z = &zc_sends[i];
+    if (z->busy)
+      continue;
+    z->fd = fd;
+    z->start = start;
+    z->end = end;
+    z->pending = 1;
+    z->busy = 1;
+    zc_inflight++;
+    break;
+  }
+  util_spin_unlock(&zc_lock);
+  return i < ZC_INFLIGHT ? i : -1;
+}
+
+/* Let the pending send of slot i reference originals [start, end) instead */
+static void zc_pin(int i, uint64_t start, uint64_t end) {
+  struct zc_send *z = &zc_sends[i];
+
+  util_spin_lock(&zc_lock);
+  z->start = start;
+  z->end = end;
+  util_spin_unlock(&zc_lock);
+}
+
+/* The send of slot i returned; if it was accepted it took the next sequence
+ * number of its socket. Concurrent sends on one socket may swap numbers,
+ * which only matters to applications interleaving a stream. */
+static void zc_commit(int i, int sent) {
+  struct zc_send *z = &zc_sends[i];
+
+  util_spin_lock(&zc_lock);
+  if (sent) {
+    z->seq = zc_next_seq[z->fd]++;
+    z->pending = 0;
+  } else {
+    z->busy = 0;
+    zc_inflight--;
+  }
+  util_spin_unlock(&zc_lock);
+}
+
+/* Release the slots of fd whose sequence number is in [lo, hi], or all of
+ * them with all. */
+static void zc_complete(int fd, uint32_t lo, uint32_t hi, int all) {
+  int i;
+
+  util_spin_lock(&zc_lock);
+  for (i = 0; i < ZC_INFLIGHT; i++) {
+    struct zc_send *z = &zc_sends[i];
+    if (!z->busy || z->pending || z->fd != fd)
+      continue;
+    if (all || z->seq - lo <= hi - lo) {
+      z->busy = 0;
+      zc_inflight--;
+    }
+  }
+  util_spin_unlock(&zc_lock);
+}
+
+/* Read the completions queued on fd, waiting up to timeout ms for the first.
+ * The error queue is read directly from libc so that it is not tracked as a
+ * receive. */
+static void zc_reap(int fd, int timeout) {
+  char control[256];
+  struct msghdr mh;
+  struct cmsghdr *cm;
+
+  if (timeout) {
+    struct pollfd pfd = {fd, 0, 0};
+    poll(&pfd, 1, timeout);
+  }
+  for (;;) {
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    if (libc_recvmsg(fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      // the socket is gone, and with it any completion still to come
+      if (errno != EAGAIN && errno != EINTR)
+        zc_complete(fd, 0, 0, 1);
+      return;
+    }
+    for (cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+      struct sock_extended_err *serr;
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+      serr = (struct sock_extended_err *)CMSG_DATA(cm);
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      zc_complete(fd, serr->ee_info, serr->ee_data, 0);
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        STAT_ADD(zerocopy_copied, serr->ee_data - serr->ee_info + 1);
+    }
+  }
+}
+
+/* Whether a send references originals [start, start + len): sets *fd to the
+ * socket of one waiting for its completion if there is any, -1 if all of
+ * them are still in their syscall. */
+static int zc_find(uint64_t start, uint64_t len, int *fd) {
+  int i, found = 0;
+
+  *fd = -1;
+  if (!__atomic_load_n(&zc_inflight, __ATOMIC_ACQUIRE))
+    return 0;
+  util_spin_lock(&zc_lock);
+  for (i = 0; i < ZC_INFLIGHT; i++) {
+    struct zc_send *z = &zc_sends[i];
+    if (!z->busy || z->end <= start || start + len <= z->start)
+      continue;
+    found = 1;
+    if (!z->pending) {
+      *fd = z->fd;
+      break;
+    }
+  }
+  util_spin_unlock(&zc_lock);
+  return found;
+}
+
+/* Wait until no send references originals [start, start + len) */
+static void zc_wait(uint64_t start, uint64_t len) {
+  int fd;
+
+  while (zc_find(start, len, &fd)) {
+    if (fd >= 0)
+      zc_reap(fd, 10);
+    else
+      sched_yield();
+  }
+}
+
+/* Whether a send still references originals [start, start + len), after
+ * reading the completions already queued for it */
+static int zc_busy(uint64_t start, uint64_t len) {
+  int fd;
+
+  if (!zc_find(start, len, &fd))
+    return 0;
+  if (fd >= 0)
+    zc_reap(fd, 0);
+  return zc_find(start, len, &fd);
+}
+
+/* Wait, for a bounded time, for the completions of the zerocopy sends on fd
+ * before it is closed, and forget the rest: they are lost with the socket. */
+static void zc_drain(int fd) {
+  int i, tries, busy = 1;
+
+  for (tries = 0; busy && tries < 100; tries++) {
+    busy = 0;
+    util_spin_lock(&zc_lock);
+    for (i = 0; i < ZC_INFLIGHT; i++)
+      busy |= zc_sends[i].busy && !zc_sends[i].pending &&
+              zc_sends[i].fd == fd;
+    util_spin_unlock(&zc_lock);
+    if (busy)
+      zc_reap(fd, 10);
+  }
+  zc_complete(fd, 0, 0, 1);
+}
+
+/* Materialise the pages of every copy that alias original bytes
+ * [start, start + len). Must be called without any shard lock held.
+ * Candidates are collected from the reverse index under the bucket lock, then
+ * re-checked under their shard lock; the scan repeats until a bucket yields
+ * no more overlapping copies. */
+static void resolve_copies_of(uint64_t start, uint64_t len) {
+  uint64_t granule;
+
+  LOG("[%s] the original buffer %p exists\n", __func__, (void *)start);
+  for (granule = SHARD_BASE(start); granule < start + len;
+       granule += ZIO_SHARD_SIZE) {
+    struct ridx_bucket *b = &ridx_buckets[RIDX_BUCKET(granule)];
+
+    for (;;) {
+      uint64_t copies[RIDX_BATCH];
+      int ncopies = 0;
+      int i;
+
+      util_spin_lock(&b->lock);
+      for (struct ridx_link *l = b->head; l && ncopies < RIDX_BATCH;
+           l = l->next) {
+        snode *x = l->node;
+        uint64_t orig_start = x->orig + x->offset;
+        if (orig_start < start + len && start < orig_start + x->len)
+          copies[ncopies++] = x->addr + x->offset;
+      }
+      util_spin_unlock(&b->lock);
+
+      if (ncopies == 0)
+        break;
+
+      for (i = 0; i < ncopies; i++) {
+        struct addr_shard *shard = &shards[SHARD_IDX(copies[i])];
+        snode *spare = skiplist_node_alloc();
+        snode *entry;
+        uint64_t orig_start;
+
+        pthread_mutex_lock(&shard->mu);
+        entry = skiplist_search(&shard->list, copies[i]);
+        orig_start = entry ? entry->orig + entry->offset : 0;
+        if (entry && entry->orig != entry->addr &&
+            orig_start < start + len && start < orig_start + entry->len) {
+          // only the pages of the copy that alias the range
+          const uint64_t delta = entry->orig - entry->addr;
+
+          LOG("[%s] copy from %p-%p to %p-%p\n", __func__, start,
+              start + len, start - delta, start + len - delta);
+
+          entry = copy_cut_locked(&shard->list, entry, start - delta,
+                                  start + len - delta, 1, &spare);
+        } else {
+          entry = NULL;
+        }
+        pthread_mutex_unlock(&shard->mu);
+        skiplist_node_free(entry);
+        skiplist_node_free(spare);
+      }
+    }
+  }
+}
+
+/* Materialise the copies of original bytes [start, start + len) and return
+ * once no send references them either, so the caller may let them be
+ * written or freed. Must be called without any shard lock held. */
+static void copy_from_original(uint64_t start, uint64_t len) {
+  resolve_copies_of(start, len);
+  zc_wait(start, len);
+}
+
+static inline int nothing_tracked(void) {
+  return __atomic_load_n(&zstats->tracked_entries, __ATOMIC_RELAXED) == 0;
+}
+
+/* Stop tracking the copies overlapping [start, start + len). With
+ * keep_contents their pages in the range get their own contents first;
+ * without, the range is being overwritten or freed and only pages reaching
+ * beyond it are resolved. Parts of the copies outside the range stay
+ * tracked. Returns how many entries were cut. */
+static int untrack_copies(uint64_t start, uint64_t len, int keep_contents) {
+  uint64_t cursor = start;
+  snode found;
+  int n = 0;
+
+  while (track_next_overlap(&cursor, start + len, &found)) {
+    struct addr_shard *shard = &shards[SHARD_IDX(found.lookup)];
+    snode *spare, *entry;
+
+    if (found.orig == found.addr)
+      continue;
+    spare = skiplist_node_alloc();
+    pthread_mutex_lock(&shard->mu);
+    entry = skiplist_search(&shard->list, found.lookup);
+    if (entry && entry->orig != entry->addr) {
+      entry = copy_cut_locked(&shard->list, entry, start, start + len,
+                              keep_contents, &spare);
+      n++;
+    } else {
+      entry = NULL;
+    }
+    pthread_mutex_unlock(&shard->mu);
+    skiplist_node_free(entry);
+    skiplist_node_free(spare);
+  }
+  return n;
+}
+
+static inline void materialize_copies(uint64_t start, uint64_t len) {
+  untrack_copies(start, len, 1);
+}
+
+/* Drop the pages of originals overlapping [start, start + len) after
+ * materialising the copies of them, and write-enable them again. Parts of
+ * the originals outside the range stay tracked. Returns how many entries
+ * were cut. */
+static int untrack_originals(uint64_t start, uint64_t len) {
+  const uint64_t first = start & PAGE_MASK;
+  const uint64_t last = (start + len + PAGE_SIZE - 1) & PAGE_MASK;
+  uint64_t cursor = start;
+  snode found;
+  int n = 0;
+
+  while (track_next_overlap(&cursor, start + len, &found)) {
+    struct addr_shard *shard = &shards[SHARD_IDX(found.lookup)];
+    const uint64_t lo = MAX(found.lookup, first);
+    const uint64_t hi = MIN(found.lookup + found.len, last);
+    snode *spare, *entry;
+
+    if (found.orig != found.addr)
+      continue;
+    copy_from_original(lo, hi - lo);
+
+    spare = skiplist_node_alloc();
+    pthread_mutex_lock(&shard->mu);
+    entry = skiplist_search(&shard->list, found.lookup);
+    if (entry && entry->orig == entry->addr &&
+        MAX(entry->lookup, lo) < MIN(entry->lookup + entry->len, hi)) {
+      struct uffdio_writeprotect wp;
+      uint64_t rs, re;
+      entry = track_cut_locked(&shard->list, entry, MAX(entry->lookup, lo),
+                               MIN(entry->lookup + entry->len, hi), 0, &spare,
+                               &rs, &re);
+      wp.range.start = rs;
+      wp.range.len = re - rs;
+      wp.mode = 0;
+      // fails harmlessly if it was never protected
+      ioctl(uffd, UFFDIO_WRITEPROTECT, &wp);
+      n++;
+    } else {
+      entry = NULL;
+    }
+    pthread_mutex_unlock(&shard->mu);
+    skiplist_node_free(entry);
+    skiplist_node_free(spare);
+  }
+  return n;
+}
+
+/* [start, start + len) is about to be freed or unmapped. Copies of it get
+ * their own pages, copies in it are dropped unresolved, and with unregister
+ * the pages inside it are no longer registered with userfaultfd, so that the
+ * allocator can hand them out again as plain memory. */
+static void track_release(uint64_t start, uint64_t len, int unregister) {
+  struct uffdio_range range;
+
+  if (nothing_tracked())
+    return;
+  if (untrack_originals(start, len) + untrack_copies(start, len, 0) == 0 ||
+      !unregister)
+    return;
+
+  range.start = start + LEFT_FRINGE_LEN(start);
+  range.len = ((start + len) & PAGE_MASK) - range.start;
+  if ((int64_t)range.len > 0)
+    ioctl(uffd, UFFDIO_UNREGISTER, &range);
+}
 
 static inline uint64_t rdtsc(void)
 {
@@ -189,6 +1302,14 @@ static inline uint64_t rdtsc(void)
     return ((uint64_t) edx << 32) | eax;
 }
 
+static inline void fault_hist_record(enum zio_fault_kind kind,
+                                     uint64_t cycles) {
+  int bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+  if (bucket >= ZIO_STATS_HIST_BUCKETS)
+    bucket = ZIO_STATS_HIST_BUCKETS - 1;
+  STAT_ADD(fault_hist[kind][bucket], 1);
+}
+
 void print_trace(void) {
   char **strings;
   size_t i, size;
@@ -201,130 +1322,495 @@ void print_trace(void) {
   free(strings);
 }
 
-ssize_t pwrite(int sockfd, const void *buf, size_t count, off_t offset) {
-  ensure_init();
+/* Where the pieces of a send come from, see send_iov_build() */
+struct send_res {
+  int resolved;           // some piece comes from the original of a copy
+  uint64_t lo, hi;        // the originals referenced lie in [lo, hi)
+  uint8_t orig[IOV_MAX];  // whether iov[i] only references originals
+};
+
+/* Append [buf, buf + count) to iov[0, n) with tracked copies replaced by
+ * their originals, merging contiguous runs, and return the new count. Stops
+ * at max entries with *covered bytes described, and records in *res which
+ * entries reference originals. The caller holds the shard locks of the
+ * range and pins the originals with zc_pin() before releasing them, so they
+ * stay unmodified until the data has been handed to the kernel. */
+static int send_iov_build(uint64_t buf, uint64_t count, struct iovec *iov,
+                          int n, int max, uint64_t *covered,
+                          struct send_res *res) {
+  uint64_t off = 0;
 
-  const int cannot_optimize = (count <= OPT_THRESHOLD);
+  while (off < count) {
+    const uint64_t addr = buf + off;
+    snode *entry = skiplist_search_buffer_fallin(SHARD_LIST(addr), addr);
+    const int orig = entry && entry->orig != entry->addr;
+    uint64_t src, len;
 
-  if (cannot_optimize) {
-    num_slow_writes++;
-    return libc_pwrite(sockfd, buf, count, offset);
+    if (entry) {
+      src = entry->orig + (addr - entry->addr);
+      len = entry->addr + entry->offset + entry->len - addr;
+    } else {
+      // untracked up to the next entry of this granule
+      const uint64_t end = MIN(buf + count, SHARD_BASE(addr) + ZIO_SHARD_SIZE);
+      snode *next = skiplist_search_overlap(SHARD_LIST(addr), addr, end);
+      src = addr;
+      len = (next ? next->lookup : end) - addr;
+    }
+    len = MIN(len, count - off);
+
+    if (n > 0 && (uint64_t)iov[n - 1].iov_base + iov[n - 1].iov_len == src) {
+      iov[n - 1].iov_len += len;
+      res->orig[n - 1] &= orig;
+    } else {
+      if (n == max)
+        break;
+      iov[n].iov_base = (void *)src;
+      iov[n].iov_len = len;
+      res->orig[n] = orig;
+      n++;
+    }
+    if (orig) {
+      res->lo = res->resolved ? MIN(res->lo, src) : src;
+      res->hi = MAX(res->hi, src + len);
+      res->resolved = 1;
+    }
+    off += len;
   }
+  *covered = off;
+  return n;
+}
 
-  pthread_mutex_lock(&mu);
+enum send_kind { SEND_MSG, SEND_WRITE, SEND_PWRITE };
+
+/* Where send_resolved() puts the data */
+struct send_dst {
+  int fd;
+  enum send_kind kind;
+  int flags;
+  const struct msghdr *hdr; // name and control data of a SEND_MSG, or NULL
+  off_t offset;             // file offset of a SEND_PWRITE
+  int nowait;               // fail instead of waiting for the peer
+};
+
+static ssize_t send_iov(const struct send_dst *dst, struct iovec *iov, int n,
+                        int flags) {
+  struct msghdr mh;
+
+  if (dst->kind == SEND_WRITE && dst->nowait)
+    return pwritev2(dst->fd, iov, n, -1, RWF_NOWAIT);
+  if (dst->kind == SEND_WRITE)
+    return libc_writev(dst->fd, iov, n);
+  if (dst->kind == SEND_PWRITE)
+    return libc_pwritev(dst->fd, iov, n, dst->offset);
+  memset(&mh, 0, sizeof(mh));
+  if (dst->hdr) {
+    mh.msg_name = dst->hdr->msg_name;
+    mh.msg_namelen = dst->hdr->msg_namelen;
+    mh.msg_control = dst->hdr->msg_control;
+    mh.msg_controllen = dst->hdr->msg_controllen;
+  }
+  mh.msg_iov = iov;
+  mh.msg_iovlen = n;
+  return libc_sendmsg(dst->fd, &mh, dst->nowait ? flags | MSG_DONTWAIT : flags);
+}
 
-  //const uint64_t left_fringe_len = LEFT_FRINGE_LEN(buf);
-  //const uint64_t right_fringe_len = RIGHT_FRINGE_LEN(count, left_fringe_len);
+/* Send iov[0, n) built by send_iov_build(). On a stream socket with zerocopy
+ * enabled, the runs of entries that only reference originals go out with
+ * MSG_ZEROCOPY if they are large enough: originals are write protected, so
+ * they stay intact until the completion. The rest is the application's own
+ * memory, which may change as soon as the call returns, and is sent in
+ * separate ordinary calls. Stops at the first short send. */
+static ssize_t send_submit(const struct send_dst *dst, struct iovec *iov,
+                           int n, const struct send_res *res) {
+  const struct send_dst run_dst = {dst->fd, SEND_MSG, 0, NULL, 0,
+                                   dst->nowait};
+  ssize_t ret = 0, total = 0;
+  int i, j;
+
+  if (res->resolved)
+    STAT_ADD(fast_writes, 1);
+  else
+    STAT_ADD(slow_writes, 1);
+
+  // control data goes with the first byte, keep it in one call
+  if (!zerocopy || !res->resolved || dst->kind == SEND_PWRITE ||
+      (dst->hdr && dst->hdr->msg_controllen) || !zc_enable(dst->fd))
+    return send_iov(dst, iov, n, dst->flags);
+
+  for (i = 0; i < n; i = j) {
+    uint64_t lo = ~0ULL, hi = 0, bytes = 0;
+    int slot = -1, run_flags;
+
+    for (j = i; j < n && res->orig[j] == res->orig[i]; j++) {
+      lo = MIN(lo, (uint64_t)iov[j].iov_base);
+      hi = MAX(hi, (uint64_t)iov[j].iov_base + iov[j].iov_len);
+      bytes += iov[j].iov_len;
+    }
+    run_flags = j < n ? dst->flags | MSG_MORE : dst->flags;
+
+    if (res->orig[i] && bytes >= zerocopy_min &&
+        (slot = zc_reserve(dst->fd, lo, hi)) >= 0) {
+      ret = send_iov(&run_dst, &iov[i], j - i, run_flags | MSG_ZEROCOPY);
+      zc_commit(slot, ret >= 0);
+      if (ret >= 0) {
+        STAT_ADD(zerocopy_sends, 1);
+        zc_reap(dst->fd, 0);
+      }
+    }
+    // not zerocopy, or out of memory the kernel may pin
+    if (slot < 0 || (ret < 0 && errno == ENOBUFS))
+      ret = send_iov(&run_dst, &iov[i], j - i, run_flags);
+
+    if (ret < 0)
+      return total ? total : ret;
+    total += ret;
+    if ((uint64_t)ret < bytes)
+      break;
+  }
+  return total;
+}
 
-  struct iovec iovec[IOV_MAX_CNT];
-  int iovcnt = 0;
+/* Whether a send to fd may be split into several calls without changing
+ * what the peer sees: files and stream sockets, not datagrams */
+static int send_may_split(int fd) {
+  int type;
+  socklen_t len = sizeof(type);
 
-  uint64_t off = 0;
-  uint64_t remaining_len = count;
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+    return errno == ENOTSOCK;
+  return type == SOCK_STREAM;
+}
 
-  while (remaining_len > 0) {
-    snode *entry =
-        skiplist_search_buffer_fallin(&addr_list, (uint64_t)buf + off);
+/* Whether a send to dst may wait for its peer, as on pipes and sockets,
+ * rather than just for the device of a file */
+static int send_may_wait(const struct send_dst *dst) {
+  struct stat st;
 
-    if (entry) {
-      iovec[iovcnt].iov_base = (void*)(entry->orig + ((uint64_t)buf - entry->addr) + off);
-      iovec[iovcnt].iov_len = entry->len;
-    } else {
-      iovec[iovcnt].iov_base = (void*)((uint64_t)buf + off);
-      iovec[iovcnt].iov_len = LEFT_FRINGE_LEN(iovec[iovcnt].iov_base) == 0
-                                  ? PAGE_SIZE
-                                  : LEFT_FRINGE_LEN(iovec[iovcnt].iov_base);
-    }
+  if (dst->kind == SEND_PWRITE)
+    return 0;
+  if (dst->kind == SEND_WRITE && fstat(dst->fd, &st) == 0)
+    return !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode);
+  return 1;
+}
 
-    iovec[iovcnt].iov_len = MIN(remaining_len, iovec[iovcnt].iov_len);
+/* Whether the application asked for a send to dst that does not block */
+static int send_nonblocking(const struct send_dst *dst) {
+  if (dst->kind == SEND_MSG && (dst->flags & MSG_DONTWAIT))
+    return 1;
+  return (fcntl(dst->fd, F_GETFL) & O_NONBLOCK) != 0;
+}
 
-    off += iovec[iovcnt].iov_len;
-    remaining_len -= iovec[iovcnt].iov_len;
+/* Fill iov with src[i, cnt) from byte off of src[i] on, returns the count */
+static int send_iov_tail(const struct iovec *src, int cnt, int i, uint64_t off,
+                         struct iovec *iov) {
+  int n = 0;
+
+  for (; i < cnt && off >= src[i].iov_len; i++)
+    off -= src[i].iov_len;
+  for (; i < cnt; i++, off = 0) {
+    iov[n].iov_base = (char *)src[i].iov_base + off;
+    iov[n].iov_len = src[i].iov_len - off;
+    n++;
+  }
+  return n;
+}
 
-    ++iovcnt;
+/* Send src[0, cnt) from the originals of its tracked copies, so that they are
+ * not faulted in just to be read by the kernel. The pieces go out in calls of
+ * at most IOV_MAX entries until one of them is short, which ends the send
+ * like any short write. The originals of each call are pinned by a pending
+ * slot in zc_sends[] while it is in flight; without a free slot, and for a
+ * datagram that needs more than IOV_MAX pieces, src is sent as it is.
+ *
+ * A pinned original cannot be written, so a call that may wait for its peer
+ * must not wait while pinning: the peer may be about to write the original
+ * before it reads. Such calls are made nonblocking, and when one would have
+ * blocked, the pin is dropped and the rest of src goes out as it is, faulting
+ * in the copies the kernel reads. */
+static ssize_t send_resolved(struct send_dst *dst, const struct iovec *src,
+                             int cnt) {
+  struct iovec iov[IOV_MAX];
+  struct send_res res;
+  uint64_t mask = 0, off = 0, covered, want, start_off;
+  ssize_t ret = 0, total = 0;
+  int i, n, pin, start, blocked;
+
+  if ((pin = zc_reserve(dst->fd, 0, 0)) < 0)
+    return send_iov(dst, (struct iovec *)src, cnt, dst->flags);
+
+  for (i = 0; i < cnt; i++)
+    mask |= shard_mask((uint64_t)src[i].iov_base, src[i].iov_len);
+  dst->nowait = send_may_wait(dst);
+
+  for (i = 0; i < cnt;) {
+    memset(&res, 0, sizeof(res));
+    n = 0;
+    want = 0;
+    start = i;
+    start_off = off;
+    shards_lock(mask);
+    while (i < cnt) {
+      n = send_iov_build((uint64_t)src[i].iov_base + off,
+                         src[i].iov_len - off, iov, n, IOV_MAX, &covered,
+                         &res);
+      want += covered;
+      off += covered;
+      if (off < src[i].iov_len)
+        break;
+      off = 0;
+      i++;
+    }
+    zc_pin(pin, res.lo, res.hi);
+    shards_unlock(mask);
+    if (i < cnt && total == 0 && !send_may_split(dst->fd)) {
+      zc_commit(pin, 0);
+      dst->nowait = 0;
+      return send_iov(dst, (struct iovec *)src, cnt, dst->flags);
+    }
 
-    if (iovcnt >= IOV_MAX_CNT) {
-      errno = ENOMEM;
-      perror("pwrite iov is full");
-      abort();
+    ret = send_submit(dst, iov, n, &res);
+    if (!dst->nowait)
+      blocked = 0;
+    else if (ret < 0)
+      blocked = errno == EOPNOTSUPP ||
+                (errno == EAGAIN && !send_nonblocking(dst));
+    else
+      blocked = (uint64_t)ret < want && !send_nonblocking(dst);
+    if (blocked) {
+      // would have blocked, or cannot be made nonblocking: wait unpinned
+      zc_commit(pin, 0);
+      if (ret > 0) {
+        total += ret;
+        dst->hdr = NULL;
+      }
+      dst->nowait = 0;
+      n = send_iov_tail(src, cnt, start, start_off + MAX(ret, 0), iov);
+      ret = send_iov(dst, iov, n, dst->flags);
+      if (ret > 0)
+        total += ret;
+      return total ? total : ret;
     }
+    if (ret < 0)
+      break;
+    total += ret;
+    if ((uint64_t)ret < want)
+      break;
+    // the name and control data went with the first call
+    dst->hdr = NULL;
+    dst->offset += ret;
   }
+  zc_commit(pin, 0);
+  return total ? total : ret;
+}
 
-#if LOGON
-  {
-    int i;
-    int total_len = 0;
-    for (i = 0; i < iovcnt; i++) {
-      printf("iov[%d]: base %p len %lu\n", i, iovec[i].iov_base,
-             iovec[i].iov_len);
-      total_len += iovec[i].iov_len;
-    }
+ssize_t write(int fd, const void *buf, size_t count) {
+  ensure_init();
+
+  if (count <= OPT_THRESHOLD || nothing_tracked())
+    return libc_write(fd, buf, count);
+
+  const struct iovec iov = {(void *)buf, count};
+  struct send_dst dst = {fd, SEND_WRITE, 0, NULL, 0};
+  return send_resolved(&dst, &iov, 1);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+  ensure_init();
+
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    total += iov[i].iov_len;
+  if (total <= OPT_THRESHOLD || iovcnt > IOV_MAX || nothing_tracked())
+    return libc_writev(fd, iov, iovcnt);
+
+  struct send_dst dst = {fd, SEND_WRITE, 0, NULL, 0};
+  return send_resolved(&dst, iov, iovcnt);
+}
+
+ssize_t sendto(int sockfd, const void *buf, size_t count, int flags,
+               const struct sockaddr *addr, socklen_t addrlen) {
+  ensure_init();
+
+  if (count <= OPT_THRESHOLD || nothing_tracked())
+    return libc_sendto(sockfd, buf, count, flags, addr, addrlen);
 
-    printf("total: %d, count: %d\n", total_len, count);
+  const struct iovec iov = {(void *)buf, count};
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_name = (void *)addr;
+  mh.msg_namelen = addrlen;
+  struct send_dst dst = {sockfd, SEND_MSG, flags, &mh, 0};
+  return send_resolved(&dst, &iov, 1);
+}
+
+ssize_t pwrite(int sockfd, const void *buf, size_t count, off_t offset) {
+  ensure_init();
+
+  const int cannot_optimize = (count <= OPT_THRESHOLD) || nothing_tracked();
+
+  if (cannot_optimize) {
+    STAT_ADD(slow_writes, 1);
+    return libc_pwrite(sockfd, buf, count, offset);
   }
-#endif
 
-  num_fast_writes++;
+  const struct iovec iov = {(void *)buf, count};
+  struct send_dst dst = {sockfd, SEND_PWRITE, 0, NULL, offset};
+  return send_resolved(&dst, &iov, 1);
+}
 
-  ssize_t ret = libc_pwritev(sockfd, iovec, iovcnt, offset);
+__thread int recursive_copy = 0;
 
-  pthread_mutex_unlock(&mu);
+/* [addr, addr + len) is written by a copy, or has just been received into.
+ * Copies of it are materialised page by page and it stops being an original
+ * there. Pages of tracked copies in it are dropped if overwrite says that all
+ * of them are overwritten, and resolved otherwise; parts of entries outside
+ * the range stay tracked. */
+void handle_existing_buffer(uint64_t addr, uint64_t len, int overwrite) {
+  uint64_t start;
 
-  return ret;
+  if (nothing_tracked())
+    return;
+  start = rdtsc();
+  untrack_originals(addr, len);
+  untrack_copies(addr, len, !overwrite);
+  STAT_ADD(time_search, rdtsc() - start);
 }
 
-int recursive_copy = 0;
+/* Whether any entry overlaps [start, start + len), caller holds the shard
+ * locks of the range */
+static int range_tracked_locked(uint64_t start, uint64_t len) {
+  uint64_t base;
 
-void handle_existing_buffer(uint64_t addr) {
-  uint64_t start = rdtsc();
-  snode *exist = skiplist_search(&addr_list, addr);
-  time_search += rdtsc() - start;
-  if (exist) {
+  for (base = SHARD_BASE(start); base < start + len; base += ZIO_SHARD_SIZE)
+    if (skiplist_search_overlap(SHARD_LIST(base), MAX(start, base),
+                                MIN(start + len, base + ZIO_SHARD_SIZE)))
+      return 1;
+  return 0;
+}
 
-#if LOGON	  
-	 printf("existing entry\n");
-    snode_dump(exist);
-#endif
+/* With ZIO_REMAP=1, a copy between buffers at the same offset within the
+ * page moves the source pages into the destination with
+ * mremap(MREMAP_DONTUNMAP) instead of deferring the copy. The destination
+ * then owns the data and is tracked as the write protected original; the
+ * emptied source becomes an elided copy of it. Reads of the copy never
+ * fault, and a source that is freed or overwritten afterwards is never
+ * copied at all. Only untracked ranges are moved; returns 0 to fall back to
+ * ordinary elision when the range is too short or tracked, and copies the
+ * range itself when the move fails. */
+static int remap_copy(void *dest, const void *src, size_t n, uint32_t site) {
+  const uint64_t left_fringe_len = LEFT_FRINGE_LEN(src);
+  const uint64_t core_src = (uint64_t)src + left_fringe_len;
+  const uint64_t core_dst = (uint64_t)dest + left_fringe_len;
+  const uint64_t core_len = (n - left_fringe_len) & PAGE_MASK;
+  const uint64_t right = left_fringe_len + core_len;
+  struct uffdio_register reg;
+  struct uffdio_writeprotect wp;
+  snode copy, orig;
+  snode *spare_copy, *spare_orig;
+  uint64_t mask;
+
+  if (core_len <= OPT_THRESHOLD)
+    return 0;
+
+  // what the destination held is overwritten, or resolved if it has copies
+  untrack_copies(core_dst, core_len, 0);
+  untrack_originals(core_dst, core_len);
+
+  copy.lookup = core_src;
+  copy.addr = (uint64_t)src;
+  copy.orig = (uint64_t)dest;
+  copy.offset = left_fringe_len;
+  copy.len = core_len;
+  copy.site = site;
+  copy.huge = 0;
+  orig = copy;
+  orig.lookup = core_dst;
+  orig.addr = (uint64_t)dest;
+  orig.site = 0;
+
+  mask = shard_mask(core_src, core_len) | shard_mask(core_dst, core_len);
+  spare_copy = track_alloc_pieces(core_src, core_len);
+  spare_orig = track_alloc_pieces(core_dst, core_len);
+  shards_lock(mask);
+  if (range_tracked_locked(core_src, core_len) ||
+      range_tracked_locked(core_dst, core_len)) {
+    shards_unlock(mask);
+    skiplist_node_chain_free(spare_copy);
+    skiplist_node_chain_free(spare_orig);
+    return 0;
+  }
 
-    if (exist->orig == exist->addr) {
-      // if this was the original, copy this to buffers tracking it
-      copy_from_original(exist->addr);
-    } else {
-      mmap((void *)(exist->addr + exist->offset), exist->len, 
-               PROT_READ | PROT_WRITE,
-               MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
-      libc_memcpy((void *)(exist->addr + exist->offset), 
-                  (void *)(exist->orig + exist->offset),
-                  exist->len);
-
-      uint64_t next_buffer = exist->addr + exist->offset + exist->len;
-      handle_existing_buffer(next_buffer + LEFT_FRINGE_LEN(next_buffer));
-    }
+  // the source stays registered across the move, so that the pages it loses
+  // fault; the moved pages come without the registration
+  reg.range.start = core_src;
+  reg.range.len = core_len;
+  reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+  reg.ioctls = 0;
+  if (ioctl(uffd, UFFDIO_REGISTER, &reg) == -1)
+    goto fail;
+  if (mremap((void *)core_src, core_len, core_len,
+             MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP,
+             (void *)core_dst) == MAP_FAILED) {
+    LOG("[%s] mremap failed, errno %d\n", __func__, errno);
+    goto fail;
+  }
 
-    // TODO: we need to split the current tracking buffer by cases (see page
-    // fulat handling) A naive way is to copy the entire buffer that is touched
-#if LOGON
-    printf("[%s] deleted entry\n", __func__);
-    snode_dump(exist);
-#endif
-    skiplist_delete(&addr_list, exist->lookup);
+  reg.range.start = core_dst;
+  reg.mode = UFFDIO_REGISTER_MODE_WP;
+  wp.range.start = core_dst;
+  wp.range.len = core_len;
+  wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+  if (ioctl(uffd, UFFDIO_REGISTER, &reg) == -1 ||
+      ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+    perror("write protect moved pages");
+    abort();
   }
+  track_insert_locked(&copy, &spare_copy);
+  track_insert_locked(&orig, &spare_orig);
+  shards_unlock(mask);
+  skiplist_node_chain_free(spare_copy);
+  skiplist_node_chain_free(spare_orig);
+
+  libc_memcpy(dest, src, left_fringe_len);
+  libc_memcpy((char *)dest + right, (const char *)src + right, n - right);
+
+  elide_account(site, core_len / PAGE_SIZE, 0);
+  STAT_ADD(elided_bytes, core_len);
+  STAT_ADD(remapped_bytes, core_len);
+  STAT_ADD(fast_copies, 1);
+  return 1;
+
+fail:
+  shards_unlock(mask);
+  skiplist_node_chain_free(spare_copy);
+  skiplist_node_chain_free(spare_orig);
+  libc_memcpy(dest, src, n);
+  STAT_ADD(slow_copies, 1);
+  return 1;
 }
 
-void *memcpy(void *dest, const void *src, size_t n) {
+/* memcpy() on behalf of the caller at return address caller */
+static void *elide_copy(void *dest, const void *src, size_t n,
+                        const void *caller) {
   ensure_init();
 
   uint64_t start;
   // TODO: parse big copy for multiple small copies
 
-  const char cannot_optimize = (n <= OPT_THRESHOLD);
+  const char cannot_optimize =
+      (n < elide_min) || (elide_regions && region_depth == 0);
 
   if (cannot_optimize) {
     return libc_memcpy(dest, src, n);
   }
 
-  if (recursive_copy == 0)
-    pthread_mutex_lock(&mu);
+  const uint32_t site = elide_site_slot(caller, n);
+  if (!readonly_hinted((uint64_t)src, n) && !elide_should(site)) {
+    STAT_ADD(slow_copies, 1);
+    return libc_memcpy(dest, src, n);
+  }
 
 #if LOGON
   printf("[%s] copying %p-%p to %p-%p, size %zu\n", __func__, src, src + n,
@@ -335,12 +1821,18 @@ void *memcpy(void *dest, const void *src, size_t n) {
   uint64_t core_dst_buffer_addr = (uint64_t)dest + LEFT_FRINGE_LEN(dest);
 
   if (recursive_copy == 0)
-    handle_existing_buffer(core_dst_buffer_addr);
+    handle_existing_buffer((uint64_t)dest, n, 1);
+  if (remap_elide && recursive_copy == 0 &&
+      !(((uint64_t)dest ^ (uint64_t)src) & ~PAGE_MASK) &&
+      remap_copy(dest, src, n, site))
+    return dest;
   start = rdtsc();
-  snode *src_entry =
-      skiplist_search(&addr_list, core_src_buffer_addr);
-  
-  time_search += rdtsc() - start;
+  snode src_snapshot;
+  snode *src_entry = track_search_holding(core_src_buffer_addr, &src_snapshot)
+                         ? &src_snapshot
+                         : NULL;
+
+  STAT_ADD(time_search, rdtsc() - start);
   start = rdtsc();
 
   // Insert if entry not existing
@@ -348,20 +1840,43 @@ void *memcpy(void *dest, const void *src, size_t n) {
     uint64_t left_fringe_len = LEFT_FRINGE_LEN(src);
     uint64_t right_fringe_len = RIGHT_FRINGE_LEN(n, left_fringe_len);
     uint64_t core_buffer_len = n - (left_fringe_len + right_fringe_len);
+    uint64_t cursor = core_src_buffer_addr;
     snode new_entry;
+    // stop short of an entry tracked further into src, and copy up to it if
+    // what is left is too short to elide
+    if (track_next_overlap(&cursor, core_src_buffer_addr + core_buffer_len,
+                           &new_entry)) {
+      core_buffer_len = new_entry.lookup - core_src_buffer_addr;
+      if (core_buffer_len <= OPT_THRESHOLD) {
+        const size_t done = left_fringe_len + core_buffer_len;
+
+        libc_memcpy(dest, src, done);
+        ++recursive_copy;
+        memcpy(dest + done, src + done, n - done);
+        --recursive_copy;
+        if (recursive_copy == 0)
+          STAT_ADD(fast_copies, 1);
+        STAT_ADD(time_insert, rdtsc() - start);
+        return dest;
+      }
+    }
     new_entry.lookup = (uint64_t)src + left_fringe_len;
     new_entry.orig = (uint64_t)src;
     new_entry.addr = (uint64_t)src;
     new_entry.len = core_buffer_len;
     new_entry.offset = left_fringe_len;
-    skiplist_insert_entry(&addr_list, &new_entry);
+    new_entry.site = 0;
+    new_entry.huge = 0;
+    if (core_buffer_len)
+      track_insert(&new_entry);
 #if LOGON
     LOG("[%s] insert entry\n", __func__);
     node_dump(&new_entry);
 #endif
-    src_entry = skiplist_search(&addr_list, core_src_buffer_addr);
+    if (core_buffer_len && track_search(core_src_buffer_addr, &src_snapshot))
+      src_entry = &src_snapshot;
   }
-  time_insert += rdtsc() - start;
+  STAT_ADD(time_insert, rdtsc() - start);
 
   if (src_entry) {
 #if LOGON
@@ -404,16 +1919,19 @@ void *memcpy(void *dest, const void *src, size_t n) {
       }
     }
 
-    size_t left_fringe_len = LEFT_FRINGE_LEN(dest);
-    size_t right_fringe_len = RIGHT_FRINGE_LEN(n, left_fringe_len);
+    // the pages of dest whose bytes come from the write protected core of
+    // src_entry, which may start before src or end before src + n
+    const uint64_t src_core = src_entry->addr + src_entry->offset;
+    uint64_t core_lo = (uint64_t)dest, core_hi = (uint64_t)dest + n;
+    if (src_core > (uint64_t)src)
+      core_lo += src_core - (uint64_t)src;
+    core_hi = MIN(core_hi, src_core + src_entry->len - (uint64_t)src +
+                               (uint64_t)dest);
+    core_lo = MIN(core_lo + LEFT_FRINGE_LEN(core_lo), (uint64_t)dest + n);
+    core_hi = MAX(core_lo, (uint64_t)PAGE_ALIGN_DOWN(core_hi));
+    size_t left_fringe_len = core_lo - (uint64_t)dest;
 
-    if (left_fringe_len == 0) {
-      if (src_entry->offset > 0) {
-        left_fringe_len = PAGE_SIZE;
-      }
-    }
-
-    core_dst_buffer_addr = (uint64_t)dest + left_fringe_len;
+    core_dst_buffer_addr = core_lo;
 
     if (left_fringe_len > 0) {
       LOG("[%s] copy the left fringe %p-%p->%p-%p len: %zu\n", __func__, src,
@@ -431,19 +1949,28 @@ void *memcpy(void *dest, const void *src, size_t n) {
     dest_entry.orig =
         src_entry->orig + ((long long)src - (long long)src_entry->addr);
     dest_entry.addr = (uint64_t)dest;
-    dest_entry.len =
-        MIN(src_entry->len, n - (left_fringe_len + right_fringe_len));
+    dest_entry.len = core_hi - core_lo;
     dest_entry.offset = left_fringe_len;
+    dest_entry.site = site;
+    dest_entry.huge = huge_elide && n >= HUGE_PAGE_SIZE;
 
     size_t remaining_len = n - left_fringe_len;
-    time_other += rdtsc() - start;
+    STAT_ADD(time_other, rdtsc() - start);
 
     if (dest_entry.len > OPT_THRESHOLD) {
       start = rdtsc();
-      skiplist_insert_entry(&addr_list, &dest_entry);
+      const uint64_t dest_mask = shard_mask(core_dst_buffer_addr, dest_entry.len);
+      snode *spare = track_alloc_pieces(core_dst_buffer_addr, dest_entry.len);
+      snode *merged;
+      shards_lock(dest_mask);
+      track_insert_locked(&dest_entry, &spare);
       mmap((void *)(dest_entry.addr + dest_entry.offset), dest_entry.len,
            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
       REGISTER_FAULT((void *)(dest_entry.addr + dest_entry.offset), dest_entry.len);
+      merged = track_coalesce_locked(core_dst_buffer_addr);
+      shards_unlock(dest_mask);
+      skiplist_node_chain_free(spare);
+      skiplist_node_free(merged);
 
       LOG("[%s] tracking buffer %p-%p len:%lu\n", __func__,
              dest_entry.addr + dest_entry.offset,
@@ -454,11 +1981,21 @@ void *memcpy(void *dest, const void *src, size_t n) {
 #endif
 
       remaining_len -= dest_entry.len;
-      time_insert += rdtsc() - start;
+      elide_account(site, dest_entry.len / PAGE_SIZE, 0);
+      STAT_ADD(elided_bytes, dest_entry.len);
+      STAT_ADD(time_insert, rdtsc() - start);
+    } else {
+      // too short to elide, copied so that the rest below makes progress
+      libc_memcpy((char *)dest + left_fringe_len,
+                  (const char *)src + left_fringe_len, dest_entry.len);
+      remaining_len -= dest_entry.len;
     }
     start = rdtsc();
     LOG("[%s] remaining_len %zu out of %zu\n", __func__, remaining_len, n);
 
+    // recursing on all of it would never end
+    if (remaining_len == n)
+      return libc_memcpy(dest, src, n);
     if (remaining_len > 0) {
       ++recursive_copy;
       memcpy(dest + (n - remaining_len), src + (n - remaining_len),
@@ -472,267 +2009,347 @@ void *memcpy(void *dest, const void *src, size_t n) {
              dest + (n - remaining_len) + remaining_len, remaining_len);
     }
 
-    ++num_fast_copy;
+    STAT_ADD(fast_copies, 1);
 
     LOG("[%s] ########## Fast copy done\n", __func__);
-    pthread_mutex_unlock(&mu);
-    time_other += rdtsc() - start;
+    STAT_ADD(time_other, rdtsc() - start);
     return dest;
   } else {
     if (recursive_copy == 0) {
-      ++num_slow_copy;
+      STAT_ADD(slow_copies, 1);
 
       LOG("[%s] ########## Slow copy done\n", __func__);
-      pthread_mutex_unlock(&mu);
     }
 
     return libc_memcpy(dest, src, n);
   }
 }
 
-//void free(void *ptr) {
-  // uint64_t ptr_bounded = (uint64_t)ptr & PAGE_MASK;
-  // snode *entry = skiplist_search(&addr_list, ptr_bounded);
-
-  // if (entry) {
-  //   if (entry->orig == ptr) {
-  //     // mark for later free
-  //     entry->free = 1;
-  //     return;
-  //   } else {
-  //     skiplist_delete(&addr_list, ptr_bounded);
-  //   }
-  // }
-  //return libc_free(ptr);
-//}
+void *memcpy(void *dest, const void *src, size_t n) {
+  return elide_copy(dest, src, n, __builtin_return_address(0));
+}
 
-ssize_t send(int sockfd, const void* buf, size_t count, int flags) {
+void *memmove(void *dest, const void *src, size_t n) {
   ensure_init();
 
-  pthread_mutex_lock(&mu);
+  // only copies between disjoint buffers can alias the source
+  if ((uint64_t)dest < (uint64_t)src + n && (uint64_t)src < (uint64_t)dest + n)
+    return libc_memmove(dest, src, n);
+  return elide_copy(dest, src, n, __builtin_return_address(0));
+}
 
-  ssize_t ret = 0;
+/* Grow a large allocation by moving its pages into the new one rather than
+ * copying them. What zIO tracks in the old buffer is resolved first, so the
+ * pages moved are plain memory. MREMAP_DONTUNMAP leaves the old range mapped
+ * and empty for the allocator to reuse; where mremap() cannot move the range
+ * (a different offset within the page, several VMAs, an older kernel) it is
+ * copied as libc would. */
+void *realloc(void *ptr, size_t new_size) {
+  // the allocator may be used while init() binds the libc functions
+  if (!libc_realloc)
+    return __libc_realloc(ptr, new_size);
+  ensure_init();
 
-  //int i;
+  const size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+  if (!ptr || new_size <= old_size || old_size < realloc_remap_min)
+    return libc_realloc(ptr, new_size);
+
+  char *new_ptr = (char *)malloc(new_size);
+  if (!new_ptr)
+    return NULL;
+  if (((uint64_t)new_ptr ^ (uint64_t)ptr) & ~PAGE_MASK) {
+    libc_memcpy(new_ptr, ptr, old_size);
+    STAT_ADD(slow_copies, 1);
+    free(ptr);
+    return new_ptr;
+  }
 
-  if (count > OPT_THRESHOLD) {
+  const uint64_t left_fringe_len = LEFT_FRINGE_LEN(ptr);
+  const uint64_t core = (uint64_t)ptr + left_fringe_len;
+  const uint64_t core_len = (old_size - left_fringe_len) & PAGE_MASK;
+  const uint64_t right = left_fringe_len + core_len;
+
+  // the new buffer may be memory that still has copies tracked in it
+  materialize_copies((uint64_t)new_ptr, new_size);
+  materialize_copies((uint64_t)ptr, old_size);
+  untrack_originals((uint64_t)ptr, old_size);
+
+  libc_memcpy(new_ptr, ptr, left_fringe_len);
+  if (mremap((void *)core, core_len, core_len,
+             MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP,
+             new_ptr + left_fringe_len) == MAP_FAILED) {
+    LOG("[%s] mremap failed, errno %d\n", __func__, errno);
+    libc_memcpy(new_ptr + left_fringe_len, (void *)core, core_len);
+    STAT_ADD(slow_copies, 1);
+  } else {
+    STAT_ADD(moved_bytes, core_len);
+  }
+  libc_memcpy(new_ptr + right, (char *)ptr + right, old_size - right);
+  free(ptr);
+  return new_ptr;
+}
 
-    uint64_t off = 0;
-    //uint64_t remaining_len = count;
-    uint64_t send_buf, send_len;
+/* Freeing or unmapping an original would leave its copies reading whatever
+ * reuses the memory, and freeing a copy would leave its entry and
+ * registration behind. The userfaultfd UNMAP and REMOVE events come after
+ * the pages are gone, and glibc unmaps large chunks internally, so free(),
+ * munmap() and madvise() release the tracking state themselves. */
+void free(void *ptr) {
+  // the allocator may be used while init() binds the libc functions
+  if (!libc_free) {
+    __libc_free(ptr);
+    return;
+  }
+  if (ptr) {
+    const size_t size = malloc_usable_size(ptr);
+    if (size > OPT_THRESHOLD)
+      track_release((uint64_t)ptr, size, 1);
+  }
+  libc_free(ptr);
+}
 
-    snode *entry =
-        skiplist_search_buffer_fallin(&addr_list, (uint64_t)buf + off);
+int munmap(void *addr, size_t len) {
+  if (!libc_munmap)
+    return syscall(SYS_munmap, addr, len);
+  track_release((uint64_t)addr, len, 0);
+  return libc_munmap(addr, len);
+}
 
-    if (entry) {
-      //iovec[iovcnt].iov_base = entry->orig + (buf - entry->addr) + off;
-      send_buf = entry->orig + ((uint64_t)buf - entry->addr) + off;
-      //iovec[iovcnt].iov_len = entry->len;
-      send_len = entry->len;
-    } else {
-      //iovec[iovcnt].iov_base = buf + off;
-      //iovec[iovcnt].iov_len = LEFT_FRINGE_LEN(iovec[iovcnt].iov_base) == 0
-      //                            ? PAGE_SIZE
-      //                            : LEFT_FRINGE_LEN(iovec[iovcnt].iov_base);
-      send_buf = (uint64_t)buf;
-      send_len = count;
-    }
+int madvise(void *addr, size_t len, int advice) {
+  if (!libc_madvise)
+    return syscall(SYS_madvise, addr, len, advice);
+  if (advice == MADV_DONTNEED || advice == MADV_FREE || advice == MADV_REMOVE)
+    track_release((uint64_t)addr, len, 1);
+  return libc_madvise(addr, len, advice);
+}
 
-    ssize_t sent = libc_send(sockfd, (void *)send_buf, send_len, flags);
-    if (sent < 0) {
-      perror("send error");
-      abort();
-    }
-    ret += sent;
-  } else {
-    ssize_t sent = libc_send(sockfd, buf, count, flags);
-    if (sent < 0) {
-      perror("send error");
-      abort();
-    }
-    ret += sent;
+int close(int fd) {
+  if (fd >= 0 && fd < ZC_MAX_FDS && zc_state[fd] != ZC_UNKNOWN) {
+    if (zc_state[fd] == ZC_ON)
+      zc_drain(fd);
+    zc_state[fd] = ZC_UNKNOWN;
+    zc_next_seq[fd] = 0;
   }
+  if (!libc_close)
+    return syscall(SYS_close, fd);
+  return libc_close(fd);
+}
 
-  pthread_mutex_unlock(&mu);
-  return ret;
+ssize_t send(int sockfd, const void* buf, size_t count, int flags) {
+  ensure_init();
+
+  if (count <= OPT_THRESHOLD || nothing_tracked())
+    return libc_send(sockfd, buf, count, flags);
+
+  const struct iovec iov = {(void *)buf, count};
+  struct send_dst dst = {sockfd, SEND_MSG, flags, NULL, 0};
+  return send_resolved(&dst, &iov, 1);
 }
 
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
   ensure_init();
 
-  pthread_mutex_lock(&mu);
-
-  ssize_t ret = 0;
+  uint64_t total = 0;
+  size_t i;
 
-  int i;
-  for (i = 0; i < msg->msg_iovlen; ++i) {
-    void *buf = msg->msg_iov[i].iov_base;
-    uint64_t count = msg->msg_iov[i].iov_len;
+  for (i = 0; i < msg->msg_iovlen; i++)
+    total += msg->msg_iov[i].iov_len;
+  if (total <= OPT_THRESHOLD || msg->msg_iovlen > IOV_MAX || nothing_tracked())
+    return libc_sendmsg(sockfd, msg, flags);
 
-    if (count > OPT_THRESHOLD) {
-      struct iovec iovec[IOV_MAX_CNT];
-      int iovcnt = 0;
+  struct send_dst dst = {sockfd, SEND_MSG, flags, msg, 0};
+  return send_resolved(&dst, msg->msg_iov, msg->msg_iovlen);
+}
 
-      uint64_t off = 0;
-      uint64_t remaining_len = count;
+/* Track [buf, buf + count) as an original */
+static void track_original(uint64_t buf_addr, size_t count) {
+  uint64_t left_fringe_len = LEFT_FRINGE_LEN(buf_addr);
+  uint64_t right_fringe_len =
+      RIGHT_FRINGE_LEN(count, left_fringe_len);
+  uint64_t core_buffer_len =
+      count - (left_fringe_len + right_fringe_len);
+  snode new_entry;
+  new_entry.lookup = buf_addr + left_fringe_len;
+  new_entry.orig = buf_addr;
+  new_entry.addr = buf_addr;
+  new_entry.len = core_buffer_len;
+  new_entry.offset = left_fringe_len;
+  new_entry.site = 0;
+  new_entry.huge = 0;
+
+  handle_existing_buffer(buf_addr, count, 0);
+
+  const uint64_t mask = shard_mask(new_entry.lookup, new_entry.len);
+  snode *spare = track_alloc_pieces(new_entry.lookup, new_entry.len);
+  snode *merged = NULL;
+  shards_lock(mask);
+  track_insert_locked(&new_entry, &spare);
+  if (new_entry.len)
+    merged = track_coalesce_locked(new_entry.lookup);
+  shards_unlock(mask);
+  skiplist_node_chain_free(spare);
+  skiplist_node_free(merged);
+}
 
-      while (remaining_len > 0) {
-        snode *entry =
-            skiplist_search_buffer_fallin(&addr_list, (uint64_t)buf + off);
+ssize_t recv(int sockfd, void* buf, size_t count, int flags) {
+  ensure_init();
 
-        if (entry) {
-          iovec[iovcnt].iov_base = entry->orig + (buf - entry->addr) + off;
-          iovec[iovcnt].iov_len = entry->len;
-        } else {
-          iovec[iovcnt].iov_base = buf + off;
-          iovec[iovcnt].iov_len = LEFT_FRINGE_LEN(iovec[iovcnt].iov_base) == 0
-                                      ? PAGE_SIZE
-                                      : LEFT_FRINGE_LEN(iovec[iovcnt].iov_base);
-        }
+  ssize_t ret = 0;
+  // recv(-2, buf, count, ...) only registers buf, kept for binaries built
+  // before zio_register_buffer()
+  if(sockfd != -2)
+    ret = libc_recv(sockfd, buf, count, flags);
 
-        iovec[iovcnt].iov_len = MIN(remaining_len, iovec[iovcnt].iov_len);
+  if (count > OPT_THRESHOLD)
+    track_original((uint64_t)buf, count);
 
-        off += iovec[iovcnt].iov_len;
-        remaining_len -= iovec[iovcnt].iov_len;
+  return ret;
+}
 
-        ++iovcnt;
 
-        if (iovcnt >= IOV_MAX_CNT) {
-          errno = ENOMEM;
-          perror("iov is full");
-          abort();
-        }
-      }
+ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
+  ensure_init();
 
-      struct msghdr mh;
-      libc_memcpy(&mh, msg, sizeof(struct msghdr));
-      mh.msg_iov = iovec;
-      mh.msg_iovlen = iovcnt;
+  ssize_t ret = libc_recvmsg(sockfd, msg, flags);
 
-      ssize_t sent = libc_sendmsg(sockfd, &mh, flags);
-      if (sent < 0) {
-        perror("send error");
-        abort();
-      }
-      ret += sent;
-    } else {
-      struct iovec iovec;
-      iovec.iov_base = buf;
-      iovec.iov_len = count;
-
-      struct msghdr mh;
-      mh.msg_iov = &iovec;
-      mh.msg_iovlen = 1;
-      ssize_t sent = libc_sendmsg(sockfd, &mh, flags);
-      if (sent < 0) {
-        perror("send error");
-        abort();
-      }
-      ret += sent;
-    }
+  int i;
+  for (i = 0; i < msg->msg_iovlen; i++) {
+    if (msg->msg_iov[i].iov_len > OPT_THRESHOLD)
+      track_original((uint64_t)msg->msg_iov[i].iov_base,
+                     msg->msg_iov[i].iov_len);
   }
 
-  pthread_mutex_unlock(&mu);
   return ret;
 }
 
-ssize_t recv(int sockfd, void* buf, size_t count, int flags) {
-  ensure_init();
 
-  ssize_t ret = 0;
-  if(sockfd != -2)
-    ret = libc_recv(sockfd, buf, count, flags);
-  uint64_t buf_addr = (uint64_t) buf;
+/******************************************************************************/
+/* Control API, see zio.h */
 
-  pthread_mutex_lock(&mu);
+int zio_api_version(void) {
+  return ZIO_API_VERSION;
+}
 
-  //int i;
-    
-  uint64_t left_fringe_len = LEFT_FRINGE_LEN(buf_addr);
-  uint64_t right_fringe_len =
-      RIGHT_FRINGE_LEN(count, left_fringe_len);
-  uint64_t core_buffer_len =
-      count - (left_fringe_len + right_fringe_len);
-  if (count > OPT_THRESHOLD ) { //&& core_buffer_len > OPT_THRESHOLD) {
-    snode new_entry;
-    new_entry.lookup = buf_addr + left_fringe_len;
-    new_entry.orig = buf_addr;
-    new_entry.addr = buf_addr;
-    new_entry.len = core_buffer_len;
-    new_entry.offset = left_fringe_len;
+int zio_register_buffer(void *buf, size_t len) {
+  ensure_init();
 
-    handle_existing_buffer(new_entry.lookup);
+  if (!buf) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (len > OPT_THRESHOLD)
+    track_original((uint64_t)buf, len);
+  return 0;
+}
 
-    snode *prev = skiplist_search_buffer_fallin(
-        &addr_list, (uint64_t)PAGE_ALIGN_DOWN(new_entry.addr) - 1);
+int zio_unregister(void *buf, size_t len) {
+  uint32_t i;
 
-    if (0 && prev &&
-        prev->addr + prev->offset + prev->len + PAGE_SIZE ==
-            new_entry.addr + new_entry.offset) {
-      LOG("[%s] %p will be merged to %p-%p, %lu\n", __func__,
-              new_entry.addr, prev->addr, prev->addr + prev->len, prev->len);
+  ensure_init();
 
-      prev->len += new_entry.len + (new_entry.offset == 0 ? 0 : PAGE_SIZE);
-    } else {
-      skiplist_insert_entry(&addr_list, &new_entry);
-#if LOGON
-	LOG("[%s] insert entry\n", __func__);
-        snode_dump(&new_entry);
-#endif
-    }
+  if (!buf) {
+    errno = EINVAL;
+    return -1;
+  }
+  materialize_copies((uint64_t)buf, len);
+  untrack_originals((uint64_t)buf, len);
+
+  util_spin_lock(&readonly_hints_lock);
+  for (i = 0; i < num_readonly_hints; i++) {
+    struct readonly_hint *h = &readonly_hints[i];
+    if (h->start < (uint64_t)buf + len && (uint64_t)buf < h->end)
+      h->start = h->end = 0;
   }
+  util_spin_unlock(&readonly_hints_lock);
+  return 0;
+}
 
-  pthread_mutex_unlock(&mu);
-  return ret;
+int zio_begin_region(void) {
+  ensure_init();
+
+  if (!elide_regions)
+    __atomic_store_n(&elide_regions, 1, __ATOMIC_RELAXED);
+  region_depth++;
+  return 0;
+}
+
+int zio_end_region(void) {
+  if (region_depth == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  region_depth--;
+  return 0;
 }
 
+int zio_hint_readonly(const void *buf, size_t len) {
+  uint32_t i;
+  int ret = 0;
 
-ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
   ensure_init();
 
-  ssize_t ret = libc_recvmsg(sockfd, msg, flags);
+  if (!buf) {
+    errno = EINVAL;
+    return -1;
+  }
+  util_spin_lock(&readonly_hints_lock);
+  // reuse a slot freed by zio_unregister() before growing the table
+  for (i = 0; i < num_readonly_hints; i++)
+    if (readonly_hints[i].start == 0 && readonly_hints[i].end == 0)
+      break;
+  if (i < READONLY_HINTS) {
+    readonly_hints[i].end = (uint64_t)buf + len;
+    readonly_hints[i].start = (uint64_t)buf;
+    if (i == num_readonly_hints)
+      __atomic_store_n(&num_readonly_hints, i + 1, __ATOMIC_RELEASE);
+  } else {
+    errno = ENOSPC;
+    ret = -1;
+  }
+  util_spin_unlock(&readonly_hints_lock);
+  return ret;
+}
 
-  pthread_mutex_lock(&mu);
+int zio_materialize(void *buf, size_t len) {
+  ensure_init();
 
-  int i;
-  for (i = 0; i < msg->msg_iovlen; i++) {
-    uint64_t left_fringe_len = LEFT_FRINGE_LEN(msg->msg_iov[i].iov_base);
-    uint64_t right_fringe_len =
-        RIGHT_FRINGE_LEN(msg->msg_iov[i].iov_len, left_fringe_len);
-    uint64_t core_buffer_len =
-        msg->msg_iov[i].iov_len - (left_fringe_len + right_fringe_len);
-    if (msg->msg_iov[i].iov_len > OPT_THRESHOLD ) { //&&  core_buffer_len > OPT_THRESHOLD) {
-      snode new_entry;
-      new_entry.lookup = (uint64_t)msg->msg_iov[i].iov_base + left_fringe_len;
-      new_entry.orig = (uint64_t)msg->msg_iov[i].iov_base;
-      new_entry.addr = (uint64_t)msg->msg_iov[i].iov_base;
-      new_entry.len = core_buffer_len;
-      new_entry.offset = left_fringe_len;
-
-      handle_existing_buffer(new_entry.lookup);
-
-      snode *prev = skiplist_search_buffer_fallin(
-          &addr_list, (uint64_t)PAGE_ALIGN_DOWN(new_entry.addr) - 1);
-
-      if (0 && prev &&
-          prev->addr + prev->offset + prev->len + PAGE_SIZE ==
-              new_entry.addr + new_entry.offset) {
-        printf("[%s] %p will be merged to %p-%p, %lu\n", __func__,
-               (void *)new_entry.addr, (void *)prev->addr, 
-               (void *)(prev->addr + prev->len), prev->len);
-
-        prev->len += new_entry.len + (new_entry.offset == 0 ? 0 : PAGE_SIZE);
-      } else {
-        skiplist_insert_entry(&addr_list, &new_entry);
-        printf("[%s] insert entry\n", __func__);
-        snode_dump(&new_entry);
-      }
-    }
+  if (!buf) {
+    errno = EINVAL;
+    return -1;
   }
+  materialize_copies((uint64_t)buf, len);
+  copy_from_original((uint64_t)buf, len);
+  return 0;
+}
 
-  pthread_mutex_unlock(&mu);
-  return ret;
+int zio_stats(struct zio_stat *st, size_t size) {
+  struct zio_thread_stats t;
+  struct zio_stat out;
+
+  ensure_init();
+
+  if (!st) {
+    errno = EINVAL;
+    return -1;
+  }
+  stats_sum(&t);
+  out.fast_copies = t.fast_copies;
+  out.slow_copies = t.slow_copies;
+  out.elided_bytes = t.elided_bytes;
+  out.fast_writes = t.fast_writes;
+  out.slow_writes = t.slow_writes;
+  out.faults = t.faults;
+  out.fault_around_pages = t.fault_around_pages;
+  out.huge_faults = t.huge_faults;
+  out.tracked_buffers = zstats->tracked_entries;
+  out.original_bytes = zstats->original_bytes;
+  out.moved_bytes = t.moved_bytes;
+  out.zerocopy_sends = t.zerocopy_sends;
+  out.zerocopy_copied = t.zerocopy_copied;
+  out.remapped_bytes = t.remapped_bytes;
+  libc_memcpy(st, &out, MIN(size, sizeof(out)));
+  return 0;
 }
 
 
@@ -748,151 +2365,227 @@ static void *bind_symbol(const char *sym) {
   return ptr;
 }
 
+/* Sum of the per-thread counters so far, zio-stat shows the same live */
 void *print_stats() {
-  //while (1) {
-    LOG_STATS("fast copies: %lu\tslow copies: %lu\tfast writes: %lu\tslow "
-              "writes: %lu\tpage faults: %lu\n",
-              num_fast_copy, num_slow_copy, num_fast_writes, num_slow_writes,
-              num_faults);
-    
-    double total_time = time_search + time_insert + time_other;
-    LOG_STATS("Time: search = %lu (%.2f%%), insert =  %lu (%.2f%%), other =  %lu (%.2f%%)\n",
-              time_search, (double)time_search / total_time * 100.0, 
-              time_insert, (double)time_insert / total_time * 100.0, 
-              time_other, (double)time_other / total_time * 100.0);
-    num_fast_writes = num_slow_writes = num_fast_copy = num_slow_copy =
-        num_faults = 0;
-    time_search = time_insert = time_other = 0;
-    //sleep(1);
-  //}
+  struct zio_stats *st = zstats;
+  struct zio_thread_stats t;
+  int i, k, b;
+
+  stats_sum(&t);
+
+  LOG_STATS("fast copies: %lu\tslow copies: %lu\tfast writes: %lu\tslow "
+            "writes: %lu\tpage faults: %lu\tfault-around pages: %lu\t"
+            "huge page faults: %lu\n",
+            t.fast_copies, t.slow_copies, t.fast_writes, t.slow_writes,
+            t.faults, t.fault_around_pages, t.huge_faults);
+  LOG_STATS("elided bytes: %lu\trealloc moved bytes: %lu\tremap moved bytes: "
+            "%lu\ttracked buffers: %ld\toriginal bytes: %ld\n",
+            t.elided_bytes, t.moved_bytes, t.remapped_bytes,
+            st->tracked_entries, st->original_bytes);
+  if (t.zerocopy_sends)
+    LOG_STATS("zerocopy sends: %lu\tcopied by the kernel: %lu\n",
+              t.zerocopy_sends, t.zerocopy_copied);
+
+  double total_time = t.time_search + t.time_insert + t.time_other;
+  LOG_STATS("Time: search = %lu (%.2f%%), insert =  %lu (%.2f%%), other =  %lu (%.2f%%)\n",
+            t.time_search, (double)t.time_search / total_time * 100.0,
+            t.time_insert, (double)t.time_insert / total_time * 100.0,
+            t.time_other, (double)t.time_other / total_time * 100.0);
+
+  for (k = 0; k < ZIO_FAULT_KINDS; k++) {
+    LOG_STATS("%s fault service time (cycles, log2 buckets):\n",
+              k == ZIO_FAULT_WP ? "WP" : "Missing");
+    for (b = 0; b < ZIO_STATS_HIST_BUCKETS; b++) {
+      if (t.fault_hist[k][b])
+        LOG_STATS("  [%lu, %lu): %lu\n", 1UL << b, 2UL << b,
+                  t.fault_hist[k][b]);
+    }
+  }
+
+  LOG_STATS("Elision decisions (call site, size class, elided pages, "
+            "faulted pages, skipped copies):\n");
+  for (i = 0; i < ELIDE_SITES; i++) {
+    struct zio_site_stats *e = &st->sites[i];
+    if (!e->calls && !e->elided_pages)
+      continue;
+    LOG_STATS("  %p\t2^%lu\t%lu\t%lu\t%lu\t%s\n",
+              i ? (void *)(e->key >> 6) : NULL, e->key & 63,
+              e->elided_pages, e->faulted_pages, e->skipped,
+              zio_site_copies(st, e) ? "copy" : "elide");
+  }
   return NULL;
 }
 
-void handle_missing_fault(void *fault_addr) {
+/* Update the fault-around state of entry for a fault on page and return how
+ * many bytes from page on should be resolved. */
+static uint64_t fault_around(snode *entry, uint64_t page) {
+  const uint64_t core_end = entry->addr + entry->offset + entry->len;
+  uint64_t stride = page > entry->ra_last ? page - entry->ra_last : 0;
+  uint64_t pages = 1;
+
+  if (stride > fault_around_max_stride * PAGE_SIZE || !entry->ra_last)
+    stride = 0;
+  if (stride && (!entry->ra_stride || entry->ra_stride == stride))
+    pages = MIN(MAX(entry->ra_pages, 1) * 2, fault_around_max);
+
+  entry->ra_stride = stride;
+  entry->ra_pages = pages;
+  entry->ra_last = page + (pages - 1) * stride;
+  return MIN((pages - 1) * stride + PAGE_SIZE, core_end - page);
+}
+
+/* Returns whether the range set in wake still has to be woken by the
+ * caller. */
+int handle_missing_fault(void *fault_addr, struct uffdio_range *wake) {
 
   void *fault_page_start_addr = PAGE_ALIGN_DOWN(fault_addr);
+  struct addr_shard *shard = &shards[SHARD_IDX(fault_page_start_addr)];
+  snode *spare = skiplist_node_alloc();
+  snode *deleted = NULL;
+
+  pthread_mutex_lock(&shard->mu);
 
   snode *fault_buffer_entry = skiplist_search_buffer_fallin(
-      &addr_list, (uint64_t)fault_page_start_addr);
+      &shard->list, (uint64_t)fault_page_start_addr);
   if (!fault_buffer_entry) {
-    LOG("[%s] no entry to handle fault\n", __func__);
-    skiplist_dump(&addr_list);
-    abort();
-  }
-
-  void *copy_dst = fault_page_start_addr;
-  void *copy_src =
-      (void*)(fault_buffer_entry->orig +
-      ((long long)fault_page_start_addr - (long long)fault_buffer_entry->addr));
-  size_t copy_len = PAGE_SIZE;
-
-  if (fault_buffer_entry->addr + fault_buffer_entry->offset ==
-      (uint64_t)fault_page_start_addr) {
-    fault_buffer_entry->offset += PAGE_SIZE;
-    fault_buffer_entry->len -= PAGE_SIZE;
-
-    if (fault_buffer_entry->len <= OPT_THRESHOLD) {
-      copy_dst = (void *)
-          (fault_buffer_entry->addr + fault_buffer_entry->offset - PAGE_SIZE);
-      copy_src = (void *)
-          (fault_buffer_entry->orig + fault_buffer_entry->offset - PAGE_SIZE);
-      copy_len = fault_buffer_entry->len + PAGE_SIZE;
-
-      skiplist_delete(&addr_list, fault_buffer_entry->lookup);
+    // several threads faulted on the same page and another message already
+    // resolved it. With UFFDIO_COPY the VMA stays registered, so this may
+    // also be a page that was never tracked, which reads back as zeroes.
+    LOG("[%s] page %p already resolved\n", __func__, fault_page_start_addr);
+    pthread_mutex_unlock(&shard->mu);
+    skiplist_node_free(spare);
+    wake->start = (uint64_t)fault_page_start_addr;
+    wake->len = PAGE_SIZE;
+    if (fault_mode == FAULT_MODE_COPY) {
+      struct uffdio_zeropage zero;
+      zero.range.start = (uint64_t)fault_page_start_addr;
+      zero.range.len = PAGE_SIZE;
+      zero.mode = 0;
+      if (ioctl(uffd, UFFDIO_ZEROPAGE, &zero) == 0)
+        return 0;
     }
-  } else if (fault_buffer_entry->addr + fault_buffer_entry->offset +
-                 fault_buffer_entry->len ==
-             (uint64_t)fault_page_start_addr + PAGE_SIZE) {
-    fault_buffer_entry->len -= PAGE_SIZE;
-
-    if (fault_buffer_entry->len <= OPT_THRESHOLD) {
-      copy_dst = (void *)(fault_buffer_entry->addr + fault_buffer_entry->offset);
-      copy_src = (void *)(fault_buffer_entry->orig + fault_buffer_entry->offset);
-      copy_len = fault_buffer_entry->len + PAGE_SIZE;
+    return 1;
+  }
 
-      skiplist_delete(&addr_list, fault_buffer_entry->lookup);
-    }
+  // resolve [fault page, fault page + ra_len) and keep tracking the rest
+  uint64_t ra_len;
+  if (fault_buffer_entry->huge) {
+    // resolved as a whole, as if the fault hit the start of the huge page
+    fault_page_start_addr =
+        (void *)(fault_buffer_entry->addr + fault_buffer_entry->offset);
+    ra_len = fault_buffer_entry->len;
+    STAT_ADD(huge_faults, 1);
   } else {
-    uint64_t offset = (uint64_t)fault_page_start_addr + 
-                      PAGE_SIZE - fault_buffer_entry->addr;
-
-    snode second_tracked_buffer;
-    second_tracked_buffer.lookup = fault_buffer_entry->addr + offset;
-    second_tracked_buffer.orig = fault_buffer_entry->orig + offset;
-    second_tracked_buffer.addr = fault_buffer_entry->addr + offset;
-    second_tracked_buffer.len =
-        fault_buffer_entry->len -
-        (uint64_t)(fault_page_start_addr - fault_buffer_entry->addr -
-                   fault_buffer_entry->offset) -
-        PAGE_SIZE;
-    second_tracked_buffer.offset = 0;
-
-    fault_buffer_entry->len -= second_tracked_buffer.len + PAGE_SIZE;
-
-    if (fault_buffer_entry->len <= OPT_THRESHOLD) {
-      copy_dst = (void *)(fault_buffer_entry->addr + fault_buffer_entry->offset);
-      copy_src = (void *)(fault_buffer_entry->orig + fault_buffer_entry->offset);
-      copy_len = fault_buffer_entry->len + PAGE_SIZE;
-
-      skiplist_delete(&addr_list, fault_buffer_entry->lookup);
-    }
-
-    if (second_tracked_buffer.len <= OPT_THRESHOLD) {
-      copy_len += second_tracked_buffer.len;
-    } else {
-      skiplist_insert_entry(&addr_list, &second_tracked_buffer);
-    }
+    ra_len = fault_around(fault_buffer_entry, (uint64_t)fault_page_start_addr);
+    STAT_ADD(fault_around_pages, ra_len / PAGE_SIZE - 1);
   }
 
-  mmap(copy_dst, copy_len, PROT_READ | PROT_WRITE,
-       MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  const uint64_t delta = fault_buffer_entry->orig - fault_buffer_entry->addr;
+  const uint32_t site = fault_buffer_entry->site;
+  const int huge = fault_buffer_entry->huge;
+  uint64_t copy_start, copy_end;
+  deleted = track_cut_locked(&shard->list, fault_buffer_entry,
+                             (uint64_t)fault_page_start_addr,
+                             (uint64_t)fault_page_start_addr + ra_len,
+                             OPT_THRESHOLD, &spare, &copy_start, &copy_end);
+
+  void *copy_dst = (void *)copy_start;
+  void *copy_src = (void *)(copy_start + delta);
+  size_t copy_len = copy_end - copy_start;
 
   LOG("[%s] copy from the original: %p-%p -> %p-%p, len: %lu\n", __func__,
       copy_src, copy_src + copy_len, copy_dst, copy_dst + copy_len, copy_len);
 
-  libc_memcpy(copy_dst, copy_src, copy_len);
+  const int woken =
+      huge ? resolve_huge((uint64_t)copy_dst, (uint64_t)copy_src, copy_len)
+           : resolve_range((uint64_t)copy_dst, (uint64_t)copy_src, copy_len);
+  wake->start = (uint64_t)copy_dst;
+  wake->len = copy_len;
+  elide_account(site, 0, copy_len / PAGE_SIZE);
+
+  pthread_mutex_unlock(&shard->mu);
+  skiplist_node_free(deleted);
+  skiplist_node_free(spare);
 
   LOG("[%s] copy is done. There might be another page fault unless this is "
       "shown\n",
       __func__);
 
-  struct uffdio_range range;
-  range.start = (uint64_t)fault_page_start_addr;
-  range.len = PAGE_SIZE;
+  STAT_ADD(faults, 1);
+  return !woken;
+}
+
+/* Sort the page ranges of a batch and merge adjacent ones in place, returns
+ * the number of merged ranges. Insertion sort, the batch is small and the
+ * fault threads must not allocate. */
+static int coalesce_ranges(struct uffdio_range *r, int n) {
+  int i, j, out;
+
+  for (i = 1; i < n; i++) {
+    struct uffdio_range tmp = r[i];
+    for (j = i; j > 0 && r[j - 1].start > tmp.start; j--)
+      r[j] = r[j - 1];
+    r[j] = tmp;
+  }
+
+  out = 0;
+  for (i = 0; i < n; i++) {
+    if (out > 0 && r[i].start <= r[out - 1].start + r[out - 1].len) {
+      uint64_t end = r[i].start + r[i].len;
+      if (end > r[out - 1].start + r[out - 1].len)
+        r[out - 1].len = end - r[out - 1].start;
+    } else {
+      r[out++] = r[i];
+    }
+  }
+  return out;
+}
+
+/* Retry the write faults on originals in deferred[0, n) and return how many
+ * are still referenced by a send in flight. Those are not waited for: the
+ * send may itself wait for a missing fault this thread has to resolve. */
+static int retry_deferred(struct uffdio_range *deferred, int n) {
+  int i, left = 0;
 
-  num_faults++;
+  for (i = 0; i < n; i++) {
+    struct uffdio_writeprotect wp;
 
-  if (ioctl(uffd, UFFDIO_WAKE, &range) < 0) {
-    printf("[%s] range.start: %p, range.len: %llu\n", __func__, 
-           (void *)range.start, range.len);
-    perror("uffdio wake");
-    assert(0);
+    resolve_copies_of(deferred[i].start, deferred[i].len);
+    if (zc_busy(deferred[i].start, deferred[i].len)) {
+      deferred[left++] = deferred[i];
+      continue;
+    }
+    wp.range = deferred[i];
+    wp.mode = 0;
+    if (ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+      perror("Set write protection fail");
+      abort();
+    }
   }
+  return left;
 }
 
-void *handle_fault(void *dummy) {
-  static struct uffd_msg msg[MAX_UFFD_MSGS];
+void *handle_fault(void *arg) {
+  struct uffd_msg msg[MAX_UFFD_MSGS];
+  struct uffdio_range wake[MAX_UFFD_MSGS], unprotect[MAX_UFFD_MSGS];
+  struct uffdio_range deferred[MAX_UFFD_MSGS];
+  int nwake, nunprotect, ndeferred = 0;
   ssize_t nread;
   uint64_t fault_addr;
   uint64_t fault_flags;
-  //int ret;
   int nmsgs;
   int i;
 
-  // cpu_set_t cpuset;
-  // pthread_t thread;
-  // thread = pthread_self();
-
-  // CPU_ZERO(&cpuset);
-
-  // CPU_SET(FAULT_THREAD_CPU, &cpuset);
-
-  // int s = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
-
-  // if (s != 0) {
-  //  perror("pthread_setaffinity_np");
-  //  assert(0);
-  //}
+  if (num_fault_cpus > 0) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(fault_cpus[(uintptr_t)arg % num_fault_cpus], &cpuset);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                     &cpuset);
+    if (ret != 0)
+      fprintf(stderr, "fault thread %lu: pinning failed: %s\n",
+              (uintptr_t)arg, strerror(ret));
+  }
 
   for (;;) {
     struct pollfd pollfd;
@@ -900,7 +2593,9 @@ void *handle_fault(void *dummy) {
     pollfd.fd = uffd;
     pollfd.events = POLLIN;
 
-    pollres = poll(&pollfd, 1, -1);
+    if (ndeferred)
+      ndeferred = retry_deferred(deferred, ndeferred);
+    pollres = poll(&pollfd, 1, ndeferred ? 1 : -1);
 
     // LOG("waking for page fault?\n");
 
@@ -909,7 +2604,8 @@ void *handle_fault(void *dummy) {
       perror("poll");
       assert(0);
     case 0:
-      fprintf(stderr, "poll read 0\n");
+      if (!ndeferred)
+        fprintf(stderr, "poll read 0\n");
       continue;
     case 1:
       break;
@@ -927,6 +2623,8 @@ void *handle_fault(void *dummy) {
       continue;
     }
 
+    // all fault threads poll the same uffd, whoever loses the race gets
+    // EAGAIN here
     nread = read(uffd, &msg[0], MAX_UFFD_MSGS * sizeof(struct uffd_msg));
     if (nread == 0) {
       fprintf(stderr, "EOF on userfaultfd\n");
@@ -945,82 +2643,215 @@ void *handle_fault(void *dummy) {
       assert(0);
     }
 
+    // resolve the whole batch first, then wake the faulting threads with one
+    // ioctl per run of adjacent pages
+    nwake = nunprotect = 0;
     nmsgs = nread / sizeof(struct uffd_msg);
     for (i = 0; i < nmsgs; ++i) {
-      if (msg[i].event & UFFD_EVENT_PAGEFAULT) {
+      if (msg[i].event == UFFD_EVENT_PAGEFAULT) {
         // LOG("page fault event\n");
         fault_addr = (uint64_t)msg[i].arg.pagefault.address;
         fault_flags = msg[i].arg.pagefault.flags;
+        uint64_t fault_start = rdtsc();
 
         if (fault_flags & UFFD_PAGEFAULT_FLAG_WP) {
           LOG("[%s] The original buffer is touched\n", __func__);
           //printf("caught a write-protected page fault\n");
 
-          // TODO: Currently, entire buffer is being copied, need to do
-          // page-by-page
-          copy_from_original(fault_addr);
-
-          struct uffdio_writeprotect wp;
-          wp.range.start = (uint64_t)PAGE_ALIGN_DOWN(fault_addr);
-          wp.range.len = PAGE_SIZE;
-          if (ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
-            perror("Set write protection fail");
-            abort();
+          const uint64_t page = (uint64_t)PAGE_ALIGN_DOWN(fault_addr);
+          resolve_copies_of(page, PAGE_SIZE);
+          if (ndeferred < MAX_UFFD_MSGS && zc_busy(page, PAGE_SIZE)) {
+            deferred[ndeferred].start = page;
+            deferred[ndeferred].len = PAGE_SIZE;
+            ndeferred++;
+          } else {
+            zc_wait(page, PAGE_SIZE);
+            unprotect[nunprotect].start = page;
+            unprotect[nunprotect].len = PAGE_SIZE;
+            nunprotect++;
           }
-
+          fault_hist_record(ZIO_FAULT_WP, rdtsc() - fault_start);
         } else {
           LOG("[%s] handling fault at %p\n", __func__, fault_addr);
 
-          handle_missing_fault((void *)fault_addr);
+          if (handle_missing_fault((void *)fault_addr, &wake[nwake]))
+            nwake++;
+          fault_hist_record(ZIO_FAULT_MISSING, rdtsc() - fault_start);
         }
 
-      } else if (msg[i].event & UFFD_EVENT_UNMAP) {
-        fprintf(stderr, "Received an unmap event\n");
-        assert(0);
-      } else if (msg[i].event & UFFD_EVENT_REMOVE) {
-        fprintf(stderr, "received a remove event\n");
-        assert(0);
+      } else if (msg[i].event == UFFD_EVENT_UNMAP ||
+                 msg[i].event == UFFD_EVENT_REMOVE) {
+        // not requested, free(), munmap() and madvise() release tracked
+        // memory before it goes away
+        LOG("[%s] ignoring unmap/remove event\n", __func__);
       } else {
         fprintf(stderr, "received a non page fault event\n");
         assert(0);
       }
     }
+
+    nunprotect = coalesce_ranges(unprotect, nunprotect);
+    for (i = 0; i < nunprotect; i++) {
+      struct uffdio_writeprotect wp;
+      wp.range = unprotect[i];
+      wp.mode = 0;
+      if (ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+        perror("Set write protection fail");
+        abort();
+      }
+    }
+
+    nwake = coalesce_ranges(wake, nwake);
+    for (i = 0; i < nwake; i++) {
+      if (ioctl(uffd, UFFDIO_WAKE, &wake[i]) < 0) {
+        printf("[%s] range.start: %p, range.len: %llu\n", __func__,
+               (void *)wake[i].start, wake[i].len);
+        perror("uffdio wake");
+        assert(0);
+      }
+    }
   }
 }
 
-static void init(void) {
-  printf("zIO start\n");
+/* Tunables of the elision cost model:
+ *  ZIO_ELIDE_MIN            smallest copy in bytes that may be elided
+ *  ZIO_ELIDE_MAX_FAULT_PCT  percentage of elided pages that may be faulted
+ *                           back in before a call site falls back to copying
+ *  ZIO_ELIDE_WARMUP         pages a call site elides before it is judged
+ *  ZIO_ELIDE_WINDOW         pages after which a call site's history is halved
+ *  ZIO_ELIDE_PROBE          one in this many copies is still elided at a
+ *                           call site that copies, 0 to never probe
+ *  ZIO_HUGE                 elide whole huge pages of large copies (0/1) */
+static void parse_elide_config(void) {
+  char *env;
+
+  if ((env = getenv("ZIO_ELIDE_MIN")))
+    elide_min = strtoull(env, NULL, 0);
+  if ((env = getenv("ZIO_ELIDE_MAX_FAULT_PCT")))
+    elide_max_fault_pct = strtoull(env, NULL, 0);
+  if ((env = getenv("ZIO_ELIDE_WARMUP")))
+    elide_warmup_pages = strtoull(env, NULL, 0);
+  if ((env = getenv("ZIO_ELIDE_WINDOW")))
+    elide_window_pages = strtoull(env, NULL, 0);
+  if ((env = getenv("ZIO_ELIDE_PROBE")))
+    elide_probe = strtoull(env, NULL, 0);
+  if ((env = getenv("ZIO_REGIONS")))
+    elide_regions = atoi(env) != 0;
+  if ((env = getenv("ZIO_REALLOC_REMAP_MIN")))
+    realloc_remap_min = strtoull(env, NULL, 0);
+  if ((env = getenv("ZIO_REMAP")))
+    remap_elide = atoi(env) != 0;
+  if ((env = getenv("ZIO_ZEROCOPY")))
+    zerocopy = atoi(env) != 0;
+  if ((env = getenv("ZIO_ZEROCOPY_MIN")))
+    zerocopy_min = strtoull(env, NULL, 0);
+
+  // the tracking code relies on elided copies spanning more than a page
+  if (elide_min <= OPT_THRESHOLD)
+    elide_min = OPT_THRESHOLD + 1;
+
+  // huge page elision follows the system THP setting unless ZIO_HUGE
+  // forces it on or off
+  if ((env = getenv("ZIO_HUGE"))) {
+    huge_elide = atoi(env) != 0;
+  } else {
+    char thp[64] = "";
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f) {
+      if (!fgets(thp, sizeof(thp), f))
+        thp[0] = 0;
+      fclose(f);
+    }
+    huge_elide = thp[0] && !strstr(thp, "[never]");
+  }
+}
 
-  libc_pwrite = (ssize_t(*)(int, const void *, size_t, off_t))
-                bind_symbol("pwrite");
-  libc_pwritev = (ssize_t(*)(int, const struct iovec *, int, off_t))
-                 bind_symbol("pwritev");
-  libc_memcpy = (void *(*)(void *, const void *, size_t))bind_symbol("memcpy");
-  libc_memmove = (void *(*)(void *, const void *, size_t))bind_symbol("memmove");
-  libc_realloc = (void *(*)(void *, size_t))bind_symbol("realloc");
-  //libc_free = bind_symbol("free");
-  
-  
-  libc_send = (ssize_t (*)(int, const void *, size_t, int))bind_symbol("send");
-  libc_sendmsg = (ssize_t (*)(int, const struct msghdr *, int))bind_symbol("sendmsg");
-  libc_recv = (ssize_t (*)(int, void *, size_t, int))bind_symbol("recv");
-  libc_recvmsg = (ssize_t (*)(int, struct msghdr *, int))bind_symbol("recvmsg");
+/* ZIO_FAULT_THREADS sets the number of fault threads, ZIO_FAULT_CPUS a comma
+ * separated list of CPUs they are pinned to round robin, e.g. one CPU per
+ * NUMA node. ZIO_FAULT_MODE=mmap selects the mmap based fault resolution.
+ * ZIO_FAULT_AROUND caps the fault-around window in pages (1 disables it) and
+ * ZIO_FAULT_AROUND_STRIDE the largest stride in pages it follows. */
+static void parse_fault_config(void) {
+  char *env, *end;
+
+  env = getenv("ZIO_FAULT_AROUND");
+  if (env)
+    fault_around_max = MAX(strtoull(env, NULL, 0), 1);
+  env = getenv("ZIO_FAULT_AROUND_STRIDE");
+  if (env)
+    fault_around_max_stride = strtoull(env, NULL, 0);
+
+  env = getenv("ZIO_FAULT_MODE");
+  if (env && strcmp(env, "mmap") == 0)
+    fault_mode = FAULT_MODE_MMAP;
+
+  env = getenv("ZIO_FAULT_THREADS");
+  if (env) {
+    num_fault_threads = strtol(env, NULL, 10);
+    if (num_fault_threads < 1)
+      num_fault_threads = 1;
+    if (num_fault_threads > MAX_FAULT_THREADS)
+      num_fault_threads = MAX_FAULT_THREADS;
+  }
 
-  // new tracking code
-  skiplist_init(&addr_list);
+  env = getenv("ZIO_FAULT_CPUS");
+  while (env && *env && num_fault_cpus < MAX_FAULT_THREADS) {
+    fault_cpus[num_fault_cpus++] = strtol(env, &end, 10);
+    if (end == env)
+      break;
+    env = *end == ',' ? end + 1 : end;
+  }
+}
 
-  pthread_mutex_init(&mu, NULL);
+/* Move the statistics into a shared memory segment named after the pid for
+ * zio-stat, unless ZIO_STATS=0. Without it they are only printed at exit. */
+static void stats_init(void) {
+  const char *env = getenv("ZIO_STATS");
+  struct zio_stats *st;
+  int fd;
+
+  zio_stats_boot.elide_max_fault_pct = elide_max_fault_pct;
+  zio_stats_boot.elide_warmup_pages = elide_warmup_pages;
+  if (env && atoi(env) == 0)
+    return;
+
+  snprintf(zio_stats_name, sizeof(zio_stats_name), ZIO_STATS_SHM_PREFIX "%d",
+           getpid());
+  fd = shm_open(zio_stats_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("zio stats shm_open");
+    zio_stats_name[0] = 0;
+    return;
+  }
+  if (ftruncate(fd, sizeof(*st)) != 0 ||
+      (st = (struct zio_stats *)mmap(NULL, sizeof(*st),
+                                     PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                                     0)) == MAP_FAILED) {
+    perror("zio stats mmap");
+    close(fd);
+    shm_unlink(zio_stats_name);
+    zio_stats_name[0] = 0;
+    return;
+  }
+  close(fd);
+
+  // carry over what was counted so far, threads claim new slots on their
+  // next update
+  libc_memcpy(st, &zio_stats_boot, sizeof(*st));
+  for (int i = 0; i < ZIO_STATS_MAX_THREADS; i++)
+    st->threads[i].in_use = 0;
+  st->pid = getpid();
+  __atomic_store_n(&st->magic, ZIO_STATS_MAGIC, __ATOMIC_RELEASE);
+  zstats = st;
+}
 
-#ifdef UFFD_PROTO
+static void uffd_open(void) {
   uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
   if (uffd == -1) {
     perror("uffd");
     abort();
   }
 
-  num_fast_writes = num_slow_writes = num_fast_copy = num_slow_copy =
-      num_faults = 0;
-
   struct uffdio_api uffdio_api;
   uffdio_api.api = UFFD_API;
   uffdio_api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
@@ -1032,11 +2863,150 @@ static void init(void) {
     perror("ioctl uffdio_api");
     abort();
   }
+}
 
-  if (pthread_create(&fault_thread, NULL, handle_fault, 0) != 0) {
-    perror("fault thread create");
-    abort();
+static void fault_threads_start(void) {
+  for (int i = 0; i < num_fault_threads; i++) {
+    if (pthread_create(&fault_threads[i], NULL, handle_fault,
+                       (void *)(uintptr_t)i) != 0) {
+      perror("fault thread create");
+      abort();
+    }
+  }
+}
+
+/*
+ * fork(): the child gets the tracking state, the originals and the empty
+ * pages of the copies, but neither the fault threads nor the registrations,
+ * which the kernel drops from the child's mappings without
+ * UFFD_FEATURE_EVENT_FORK, so its copies would read as zeros. The parent
+ * quiesces the tracking state across fork(); the child opens its own
+ * userfaultfd, registers its copies and originals again and starts its own
+ * fault threads, so its copies are still resolved lazily from its own
+ * snapshot of the originals.
+ */
+static void atfork_prepare(void) {
+  int i;
+
+  shards_lock(~0ULL);
+  for (i = 0; i < RIDX_BUCKETS; i++)
+    util_spin_lock(&ridx_buckets[i].lock);
+  util_spin_lock(&readonly_hints_lock);
+  util_spin_lock(&zc_lock);
+  pthread_mutex_lock(&snode_pool.mu);
+}
+
+static void atfork_parent(void) {
+  int i;
+
+  pthread_mutex_unlock(&snode_pool.mu);
+  util_spin_unlock(&zc_lock);
+  util_spin_unlock(&readonly_hints_lock);
+  for (i = RIDX_BUCKETS - 1; i >= 0; i--)
+    util_spin_unlock(&ridx_buckets[i].lock);
+  shards_unlock(~0ULL);
+}
+
+static void atfork_child(void) {
+  int i;
+
+  atfork_parent();
+
+  // zerocopy completions go to whichever process reads them first, so the
+  // child leaves the parent's sends alone and sends its own with copies
+  zerocopy = 0;
+  memset(zc_sends, 0, sizeof(zc_sends));
+  zc_inflight = 0;
+
+  // counters of the child are private, they must not add to the parent's
+  if (zstats != &zio_stats_boot) {
+    libc_memcpy(&zio_stats_boot, zstats, sizeof(zio_stats_boot));
+    libc_munmap(zstats, sizeof(*zstats));
+    zstats = &zio_stats_boot;
+  }
+  zio_stats_name[0] = 0;
+  zstats->pid = getpid();
+  for (i = 0; i < ZIO_STATS_MAX_THREADS; i++)
+    zstats->threads[i].in_use = 0;
+  thread_stats_owner = NULL;
+
+  // the parent's userfaultfd still serves the parent's memory
+  libc_close(uffd);
+  uffd_open();
+
+  for (i = 0; i < ZIO_NUM_SHARDS; i++) {
+    skiplist *list = &shards[i].list;
+    snode *x;
+
+    for (x = list->header->forward[1]; x != list->header; x = x->forward[1]) {
+      const uint64_t core = x->addr + x->offset;
+      struct uffdio_register reg;
+      struct uffdio_writeprotect wp;
+
+      if (x->orig != x->addr) {
+        REGISTER_FAULT((void *)core, x->len);
+        continue;
+      }
+      reg.range.start = core;
+      reg.range.len = x->len;
+      reg.mode = UFFDIO_REGISTER_MODE_WP;
+      reg.ioctls = 0;
+      wp.range = reg.range;
+      wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+      if (ioctl(uffd, UFFDIO_REGISTER, &reg) == -1 ||
+          ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+        perror("write protect original after fork");
+        abort();
+      }
+    }
+  }
+
+  fault_threads_start();
+}
+
+static void init(void) {
+  printf("zIO start\n");
+
+  libc_pwrite = (ssize_t(*)(int, const void *, size_t, off_t))
+                bind_symbol("pwrite");
+  libc_pwritev = (ssize_t(*)(int, const struct iovec *, int, off_t))
+                 bind_symbol("pwritev");
+  libc_memcpy = (void *(*)(void *, const void *, size_t))bind_symbol("memcpy");
+  libc_memmove = (void *(*)(void *, const void *, size_t))bind_symbol("memmove");
+  libc_realloc = (void *(*)(void *, size_t))bind_symbol("realloc");
+  libc_free = (void (*)(void *))bind_symbol("free");
+  libc_munmap = (int (*)(void *, size_t))bind_symbol("munmap");
+  libc_madvise = (int (*)(void *, size_t, int))bind_symbol("madvise");
+  libc_close = (int (*)(int))bind_symbol("close");
+  
+  
+  libc_send = (ssize_t (*)(int, const void *, size_t, int))bind_symbol("send");
+  libc_sendmsg = (ssize_t (*)(int, const struct msghdr *, int))bind_symbol("sendmsg");
+  libc_write = (ssize_t (*)(int, const void *, size_t))bind_symbol("write");
+  libc_sendto = (ssize_t (*)(int, const void *, size_t, int,
+                             const struct sockaddr *, socklen_t))
+                bind_symbol("sendto");
+  libc_writev = (ssize_t (*)(int, const struct iovec *, int))bind_symbol("writev");
+  libc_recv = (ssize_t (*)(int, void *, size_t, int))bind_symbol("recv");
+  libc_recvmsg = (ssize_t (*)(int, struct msghdr *, int))bind_symbol("recvmsg");
+
+  stats_init();
+
+  // new tracking code
+  for (int i = 0; i < ZIO_NUM_SHARDS; i++) {
+    skiplist_init(&shards[i].list);
+    pthread_mutex_init(&shards[i].mu, NULL);
   }
+
+#ifdef UFFD_PROTO
+  uffd_open();
+
+  parse_elide_config();
+  zstats->elide_max_fault_pct = elide_max_fault_pct;
+  zstats->elide_warmup_pages = elide_warmup_pages;
+  parse_fault_config();
+  fault_threads_start();
+  pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
 /*
   printf("launching stats\n");
   if (pthread_create(&stats_thread, NULL, print_stats, 0) != 0) {
@@ -1082,5 +3052,7 @@ static inline void ensure_init(void) {
 struct setup_handler {
   ~setup_handler() {
     print_stats();
+    if (zio_stats_name[0])
+      shm_unlink(zio_stats_name);
   }
 } dummy;
@@ -49,6 +49,8 @@
 #include <tas_sockets.h>
 #include <unistd.h>
 #include <utils.h>
+#define ZIO_INTERPOSER
+#include <zio.h>
 
 //#define OPT_THRESHOLD 0xfffffffffffffffff
 // #define OPT_THRESHOLD 1048575
@@ -642,15 +644,15 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
 ssize_t recv(int sockfd, void* buf, size_t count, int flags) {
   ensure_init();
 
+  // recv(-5/-6, NULL, 0, ...) are the pre-zio.h zio_begin_region() and
+  // zio_end_region()
   if(sockfd == -5 && count == 0) {
-    fprintf(stderr, "Started copy elision\n");
-    started_memcpy = true;
+    zio_begin_region();
     return libc_recv(sockfd, buf, count, flags);
   }
 
   if(sockfd == -6 && count == 0) {
-    fprintf(stderr, "Ended copy elision\n");
-    started_memcpy = false;
+    zio_end_region();
     return libc_recv(sockfd, buf, count, flags);
   }
 
@@ -750,6 +752,53 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
 }
 
 
+/******************************************************************************/
+/* Control API, see zio.h. Elision is manual here: it is on between
+ * zio_begin_region() and zio_end_region() of any thread. */
+
+int zio_api_version(void) {
+  return ZIO_API_VERSION;
+}
+
+int zio_register_buffer(void *buf, size_t len) {
+  // the recv(-2) path registers without receiving
+  recv(-2, buf, len, 0);
+  return 0;
+}
+
+int zio_begin_region(void) {
+  fprintf(stderr, "Started copy elision\n");
+  started_memcpy = true;
+  return 0;
+}
+
+int zio_end_region(void) {
+  fprintf(stderr, "Ended copy elision\n");
+  started_memcpy = false;
+  return 0;
+}
+
+int zio_unregister(void *buf, size_t len) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int zio_hint_readonly(const void *buf, size_t len) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int zio_materialize(void *buf, size_t len) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int zio_stats(struct zio_stat *st, size_t size) {
+  errno = ENOSYS;
+  return -1;
+}
+
+
 /******************************************************************************/
 /* Helper functions */
 
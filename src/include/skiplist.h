@@ -1,11 +1,22 @@
 
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
-#define SKIPLIST_MAX_LEVEL 6
+// enough levels for O(log n) searches over ~1M entries at p = 1/2
+#define SKIPLIST_MAX_LEVEL 20
+
+// link of a copy in the reverse index from originals to their copies
+struct ridx_link {
+  struct ridx_link *next;
+  struct ridx_link **pprev; // NULL while not linked
+  struct snode *node;
+  uint32_t bucket;
+};
 
 // address
 typedef struct snode {
@@ -15,7 +26,14 @@ typedef struct snode {
   uint64_t addr;   // buffer address
   uint64_t len;
   uint8_t free;
-  struct snode **forward;
+  uint8_t huge;    // a copy covering one huge page, resolved as a whole
+  uint32_t site;   // elision call site slot of a copy, 0 if none
+  uint64_t ra_last;   // fault-around: last page faulted or prefetched
+  uint32_t ra_stride; // fault-around: observed fault stride in bytes
+  uint32_t ra_pages;  // fault-around: pages resolved by the last fault
+  struct ridx_link ridx[2];
+  int level;
+  struct snode *forward[]; // level + 1 entries, forward[0] links free chains
 } snode;
 
 typedef struct skiplist {
@@ -24,13 +42,138 @@ typedef struct skiplist {
   struct snode *header;
 } skiplist;
 
+/*
+ * Nodes never come from malloc: the interposed memcpy must not call back into
+ * the application's allocator, which may itself copy or touch tracked memory.
+ * Nodes are cache-line aligned slots carved from mmap'd arenas, in one size
+ * class per number of cache lines a node of a given level needs. Each thread
+ * keeps its own free lists and hands half of a list to the shared pool once
+ * it grows past SNODE_LOCAL_MAX, or all of them when it exits.
+ */
+#define SNODE_ARENA_SIZE (2UL << 20)
+#define SNODE_LINE 64
+#define SNODE_BATCH 32
+#define SNODE_LOCAL_MAX 512
+#define SNODE_SIZE(level) (sizeof(snode) + sizeof(snode *) * ((level) + 1))
+#define SNODE_LINES(level) ((SNODE_SIZE(level) + SNODE_LINE - 1) / SNODE_LINE)
+#define SNODE_CLASS(level) (SNODE_LINES(level) - SNODE_LINES(1))
+#define SNODE_CLASSES (SNODE_LINES(SKIPLIST_MAX_LEVEL) - SNODE_LINES(1) + 1)
+
+static struct {
+  pthread_mutex_t mu;
+  pthread_once_t once;
+  pthread_key_t key;
+  snode *free[SNODE_CLASSES];
+  char *bump;
+  char *bump_end;
+} snode_pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT};
+
+static __thread snode *snode_local[SNODE_CLASSES];
+static __thread uint32_t snode_local_cnt[SNODE_CLASSES];
+static __thread uint8_t snode_local_registered;
+
+// Move up to n nodes of class c from the local list to the shared pool.
+// Caller holds snode_pool.mu.
+static inline void snode_pool_spill_locked(int c, uint32_t n) {
+  while (n-- && snode_local[c]) {
+    snode *x = snode_local[c];
+    snode_local[c] = x->forward[0];
+    x->forward[0] = snode_pool.free[c];
+    snode_pool.free[c] = x;
+    snode_local_cnt[c]--;
+  }
+}
+
+static void snode_pool_thread_exit(void *arg) {
+  int c;
+
+  pthread_mutex_lock(&snode_pool.mu);
+  for (c = 0; c < (int)SNODE_CLASSES; c++)
+    snode_pool_spill_locked(c, UINT32_MAX);
+  pthread_mutex_unlock(&snode_pool.mu);
+}
+
+static void snode_pool_key_init(void) {
+  pthread_key_create(&snode_pool.key, snode_pool_thread_exit);
+}
+
+// Make sure the local lists are handed back when this thread exits.
+static inline void snode_pool_register(void) {
+  if (!snode_local_registered) {
+    pthread_once(&snode_pool.once, snode_pool_key_init);
+    pthread_setspecific(snode_pool.key, (void *)1);
+    snode_local_registered = 1;
+  }
+}
+
+// Refill the local list of class c from the shared pool, or carve new slots
+// out of the current arena.
+static inline void snode_pool_refill(int c) {
+  const size_t slot = (c + SNODE_LINES(1)) * SNODE_LINE;
+  int i;
+
+  snode_pool_register();
+  pthread_mutex_lock(&snode_pool.mu);
+  for (i = 0; i < SNODE_BATCH && snode_pool.free[c]; i++) {
+    snode *x = snode_pool.free[c];
+    snode_pool.free[c] = x->forward[0];
+    x->forward[0] = snode_local[c];
+    snode_local[c] = x;
+    snode_local_cnt[c]++;
+  }
+  if (i == 0) {
+    if (snode_pool.bump + slot * SNODE_BATCH > snode_pool.bump_end) {
+      void *arena = mmap(NULL, SNODE_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (arena == MAP_FAILED) {
+        perror("skiplist node arena");
+        abort();
+      }
+      snode_pool.bump = (char *)arena;
+      snode_pool.bump_end = (char *)arena + SNODE_ARENA_SIZE;
+    }
+    for (i = 0; i < SNODE_BATCH; i++) {
+      snode *x = (snode *)snode_pool.bump;
+      snode_pool.bump += slot;
+      x->forward[0] = snode_local[c];
+      snode_local[c] = x;
+      snode_local_cnt[c]++;
+    }
+  }
+  pthread_mutex_unlock(&snode_pool.mu);
+}
+
+static inline snode *snode_pool_alloc(int level) {
+  const int c = SNODE_CLASS(level);
+  snode *x;
+
+  if (!snode_local[c])
+    snode_pool_refill(c);
+  x = snode_local[c];
+  snode_local[c] = x->forward[0];
+  snode_local_cnt[c]--;
+  x->level = level;
+  return x;
+}
+
+static inline void snode_pool_free(snode *x) {
+  const int c = SNODE_CLASS(x->level);
+
+  snode_pool_register();
+  x->forward[0] = snode_local[c];
+  snode_local[c] = x;
+  if (++snode_local_cnt[c] > SNODE_LOCAL_MAX) {
+    pthread_mutex_lock(&snode_pool.mu);
+    snode_pool_spill_locked(c, SNODE_LOCAL_MAX / 2);
+    pthread_mutex_unlock(&snode_pool.mu);
+  }
+}
+
 static inline skiplist *skiplist_init(skiplist *list) {
   int i;
-  snode *header = (snode *)malloc(sizeof(struct snode));
+  snode *header = snode_pool_alloc(SKIPLIST_MAX_LEVEL);
   list->header = header;
   header->lookup = 0xffffffffffffffff;
-  header->forward =
-      (snode **)malloc(sizeof(snode *) * (SKIPLIST_MAX_LEVEL + 1));
   for (i = 0; i <= SKIPLIST_MAX_LEVEL; i++) {
     header->forward[i] = list->header;
   }
@@ -41,62 +184,107 @@ static inline skiplist *skiplist_init(skiplist *list) {
   return list;
 }
 
+// per-thread xorshift, rand() serialises all callers on the libc lock
 static inline int rand_level() {
+  static __thread uint64_t seed = 0;
   int level = 1;
-  while (rand() < RAND_MAX / 2 && level < SKIPLIST_MAX_LEVEL)
+
+  if (seed == 0)
+    seed = ((uint64_t)&seed >> 4) | 1;
+
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  while ((seed & (1ULL << level)) && level < SKIPLIST_MAX_LEVEL)
     level++;
   return level;
 }
 
-static inline int skiplist_insert_with_addr(skiplist *list, uint64_t lookup,
-                                            uint64_t orig, uint64_t addr,
-                                            uint32_t len, uint64_t offset) {
+// Allocate a node without linking it, so callers holding a lock around the
+// list can allocate before taking it.
+static inline snode *skiplist_node_alloc(void) {
+  snode *x = snode_pool_alloc(rand_level());
+  x->forward[0] = NULL;
+  x->site = 0;
+  x->huge = 0;
+  x->ra_last = 0;
+  x->ra_stride = x->ra_pages = 0;
+  x->ridx[0].pprev = x->ridx[1].pprev = NULL;
+  return x;
+}
+
+static inline void skiplist_node_free(snode *x) {
+  if (x) {
+
+    /*{
+      fprintf(stderr, "\tlookup: %p\n", (void *)x->lookup);
+      fprintf(stderr, "\torig: %p\n", (void *)x->orig);
+      fprintf(stderr, "\taddr: %p\n", (void *)x->addr);
+      fprintf(stderr, "\tlen: %lu\n", x->len);
+      fprintf(stderr, "\toffset: %lu\n", x->offset);
+      fprintf(stderr, "\tcore_buffer: %p-%p\n", x->addr + x->offset,
+              x->addr + x->offset + x->len);
+      fprintf(stderr, "\tcorresponding original: %p-%p\n", x->orig + x->offset,
+              x->orig + x->offset + x->len);
+    }*/
+
+    snode_pool_free(x);
+  }
+}
+
+// Link a preallocated node. If the key already exists, the node is not linked
+// and returned to the caller. An existing node of the same kind (original or
+// copy) takes over its fields; one of the other kind is left as it is, since
+// replacing it would drop a copy unresolved or an original its copies need.
+static inline snode *skiplist_insert_node(skiplist *list, snode *node) {
   snode *update[SKIPLIST_MAX_LEVEL + 1];
   snode *x = list->header;
-  int i, level;
+  int i;
   for (i = list->level; i >= 1; i--) {
-    while (x->forward[i] && x->forward[i]->lookup < lookup)
+    while (x->forward[i] && x->forward[i]->lookup < node->lookup)
       x = x->forward[i];
     update[i] = x;
   }
 
-  // snode *prev = x->forward[1];
-  // if (prev->addr + prev->offset + prev->len + getpagesize() >= addr) {
-  //   // If a new buffer is consecutive with the existing one
-  //   // merge to the previous node
-  //   prev->len += len + getpagesize();
-  //   return 0;
-  // }
-
   x = x->forward[1];
 
-  if (x && lookup == x->lookup) {
-    x->orig = orig;
-    x->len = len;
-    x->offset = offset;
-    x->addr = addr;
-    return 0;
-  } else {
-    level = rand_level();
-    if (level > list->level) {
-      for (i = list->level + 1; i <= level; i++) {
-        update[i] = list->header;
-      }
-      list->level = level;
-    }
+  if (x && node->lookup == x->lookup) {
+    if ((x->orig == x->addr) != (node->orig == node->addr))
+      return node;
+    x->orig = node->orig;
+    x->len = node->len;
+    x->offset = node->offset;
+    x->addr = node->addr;
+    return node;
+  }
 
-    x = (snode *)malloc(sizeof(snode));
-    x->lookup = lookup;
-    x->orig = orig;
-    x->addr = addr;
-    x->len = len;
-    x->offset = offset;
-    x->forward = (snode **)malloc(sizeof(snode *) * (level + 1));
-    for (i = 1; i <= level; i++) {
-      x->forward[i] = update[i]->forward[i];
-      update[i]->forward[i] = x;
+  if (node->level > list->level) {
+    for (i = list->level + 1; i <= node->level; i++) {
+      update[i] = list->header;
     }
+    list->level = node->level;
   }
+
+  for (i = 1; i <= node->level; i++) {
+    node->forward[i] = update[i]->forward[i];
+    update[i]->forward[i] = node;
+  }
+  return NULL;
+}
+
+static inline int skiplist_insert_with_addr(skiplist *list, uint64_t lookup,
+                                            uint64_t orig, uint64_t addr,
+                                            uint32_t len, uint64_t offset) {
+  snode *x = skiplist_node_alloc();
+  x->lookup = lookup;
+  x->orig = orig;
+  x->addr = addr;
+  x->len = len;
+  x->offset = offset;
+
+  x = skiplist_insert_node(list, x);
+  if (x)
+    skiplist_node_free(x);
   return 0;
 }
 
@@ -127,40 +315,54 @@ static inline snode *skiplist_search(skiplist *list, uint64_t lookup) {
 }
 
 // XXX: naming sucks
+// Find the entry whose core buffer [addr + offset, addr + offset + len)
+// contains addr. Entries are keyed by their core start (lookup == addr +
+// offset) and do not overlap, so the only candidate is the last entry with
+// lookup <= addr, found by descending the levels like skiplist_search.
 static inline snode *skiplist_search_buffer_fallin(skiplist *list,
                                                    uint64_t addr) {
   snode *x = list->header;
-  while (x && x->forward[1] != list->header) {
-    if (x->forward[1]->addr + x->forward[1]->offset <= addr &&
-        addr < x->forward[1]->addr + x->forward[1]->offset + x->forward[1]->len)
-      return x->forward[1];
-    x = x->forward[1];
+  int i;
+  for (i = list->level; i >= 1; i--) {
+    while (x->forward[i]->lookup <= addr)
+      x = x->forward[i];
   }
 
+  if (x != list->header && x->addr + x->offset <= addr &&
+      addr < x->addr + x->offset + x->len)
+    return x;
   return NULL;
 }
 
-static inline void skiplist_node_free(snode *x) {
-  if (x) {
+// Find the first entry whose core buffer overlaps [start, end): the entry
+// containing start, else the first one starting after it.
+static inline snode *skiplist_search_overlap(skiplist *list, uint64_t start,
+                                             uint64_t end) {
+  snode *x = list->header;
+  int i;
+  for (i = list->level; i >= 1; i--) {
+    while (x->forward[i]->lookup <= start)
+      x = x->forward[i];
+  }
 
-    /*{
-      fprintf(stderr, "\tlookup: %p\n", (void *)x->lookup);
-      fprintf(stderr, "\torig: %p\n", (void *)x->orig);
-      fprintf(stderr, "\taddr: %p\n", (void *)x->addr);
-      fprintf(stderr, "\tlen: %lu\n", x->len);
-      fprintf(stderr, "\toffset: %lu\n", x->offset);
-      fprintf(stderr, "\tcore_buffer: %p-%p\n", x->addr + x->offset,
-              x->addr + x->offset + x->len);
-      fprintf(stderr, "\tcorresponding original: %p-%p\n", x->orig + x->offset,
-              x->orig + x->offset + x->len);
-    }*/
+  if (x != list->header && start < x->addr + x->offset + x->len)
+    return x;
+  x = x->forward[1];
+  if (x != list->header && x->lookup < end)
+    return x;
+  return NULL;
+}
 
-    free(x->forward);
-    free(x);
+static inline void skiplist_node_chain_free(snode *chain) {
+  while (chain) {
+    snode *next = chain->forward[0];
+    skiplist_node_free(chain);
+    chain = next;
   }
 }
 
-static inline int skiplist_delete(skiplist *list, uint64_t lookup) {
+// Unlink the node with the given key and hand it back instead of freeing it
+static inline snode *skiplist_unlink(skiplist *list, uint64_t lookup) {
   int i;
   snode *update[SKIPLIST_MAX_LEVEL + 1];
   snode *x = list->header;
@@ -177,11 +379,20 @@ static inline int skiplist_delete(skiplist *list, uint64_t lookup) {
         break;
       update[i]->forward[i] = x->forward[i];
     }
-    skiplist_node_free(x);
 
     while (list->level > 1 &&
            list->header->forward[list->level] == list->header)
       list->level--;
+    x->forward[0] = NULL;
+    return x;
+  }
+  return NULL;
+}
+
+static inline int skiplist_delete(skiplist *list, uint64_t lookup) {
+  snode *x = skiplist_unlink(list, lookup);
+  if (x) {
+    skiplist_node_free(x);
     return 0;
   }
   return 1;
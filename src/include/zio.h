@@ -0,0 +1,87 @@
+#ifndef ZIO_H_
+#define ZIO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Control interface of copy_interpose.so.
+ *
+ * Applications include this header and do not link against zIO: the
+ * functions are weak references that resolve when the library is preloaded
+ * and are NULL otherwise, so calls are guarded with ZIO_AVAILABLE(). All
+ * functions return 0 on success and -1 with errno set on failure.
+ *
+ * ZIO_API_VERSION changes whenever an existing function or struct changes
+ * meaning; new functions and new fields at the end of struct zio_stat keep
+ * it. zio_api_version() reports the version the library implements.
+ */
+#define ZIO_API_VERSION 1
+
+#ifdef ZIO_INTERPOSER
+#define ZIO_API
+#else
+#define ZIO_API __attribute__((weak))
+#endif
+
+#define ZIO_AVAILABLE() (zio_api_version != NULL)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// process-wide totals, see zio_stats.h for the per-thread breakdown
+struct zio_stat {
+  uint64_t fast_copies;
+  uint64_t slow_copies;
+  uint64_t elided_bytes;
+  uint64_t fast_writes;
+  uint64_t slow_writes;
+  uint64_t faults;
+  uint64_t fault_around_pages;
+  uint64_t huge_faults;
+  int64_t tracked_buffers;
+  int64_t original_bytes;
+  uint64_t moved_bytes;
+  uint64_t zerocopy_sends;
+  uint64_t zerocopy_copied;
+  uint64_t remapped_bytes;
+};
+
+ZIO_API int zio_api_version(void);
+
+/* Track buf as an original, as if it had just been received into. Copies
+ * from it are elided without first looking it up. */
+ZIO_API int zio_register_buffer(void *buf, size_t len);
+
+/* Stop tracking [buf, buf + len): copies in it and copies of it get their
+ * own pages and it is no longer write protected. Call before handing the
+ * memory to something zIO cannot see, e.g. a device or another process.
+ * Must not race with copies from the same range. */
+ZIO_API int zio_unregister(void *buf, size_t len);
+
+/* Restrict elision of the calling thread to regions. Once any thread has
+ * begun a region, copies are only elided between zio_begin_region() and the
+ * matching zio_end_region() of the copying thread. Regions nest. */
+ZIO_API int zio_begin_region(void);
+ZIO_API int zio_end_region(void);
+
+/* Promise that [buf, buf + len) is not written while copies of it are in
+ * use. Copies from it are elided even where the per call site cost model
+ * would copy. Dropped by zio_unregister(). */
+ZIO_API int zio_hint_readonly(const void *buf, size_t len);
+
+/* Resolve all elided state of [buf, buf + len) now instead of on fault:
+ * copies in the range get their own pages, and so do copies of it, so that
+ * neither reads nor writes of it fault later. */
+ZIO_API int zio_materialize(void *buf, size_t len);
+
+/* Fill the first size bytes of *st, size lets older callers pass an older
+ * struct zio_stat. */
+ZIO_API int zio_stats(struct zio_stat *st, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ndef ZIO_H_ */
@@ -0,0 +1,78 @@
+#ifndef ZIO_STATS_H_
+#define ZIO_STATS_H_
+
+#include <stdint.h>
+
+/*
+ * Live statistics of the copy interposer, exported in a POSIX shared memory
+ * segment named ZIO_STATS_SHM_PREFIX<pid> that zio-stat maps read-only.
+ *
+ * Counters are per thread: every thread owns a slot and is its only writer,
+ * so updates are plain relaxed stores. A reader sums the slots; slots are
+ * reused by later threads without being cleared, so the sums only grow.
+ * The gauges and the call site table are shared and updated atomically.
+ */
+#define ZIO_STATS_SHM_PREFIX "/zio-stats."
+#define ZIO_STATS_MAGIC 0x7a696f7374617431ULL
+#define ZIO_STATS_MAX_THREADS 256
+#define ZIO_STATS_HIST_BUCKETS 32
+#define ZIO_STATS_SITE_BITS 10
+#define ZIO_STATS_SITES (1 << ZIO_STATS_SITE_BITS)
+
+enum zio_fault_kind {
+  ZIO_FAULT_MISSING = 0,
+  ZIO_FAULT_WP = 1,
+  ZIO_FAULT_KINDS
+};
+
+struct zio_thread_stats {
+  uint32_t in_use;
+  uint32_t tid;
+  uint64_t fast_copies;        // copies elided
+  uint64_t elided_bytes;       // bytes not copied by elided copies
+  uint64_t slow_copies;        // large copies done by libc
+  uint64_t fast_writes;        // sends/writes built from originals
+  uint64_t slow_writes;
+  uint64_t faults;             // missing faults on copies
+  uint64_t fault_around_pages; // pages resolved ahead of a fault
+  uint64_t huge_faults;
+  uint64_t moved_bytes;        // bytes realloc() moved instead of copying
+  uint64_t remapped_bytes;     // bytes ZIO_REMAP copies moved instead
+  uint64_t zerocopy_sends;     // sends handed to the kernel with MSG_ZEROCOPY
+  uint64_t zerocopy_copied;    // of those, sends the kernel copied anyway
+  uint64_t time_search;        // cycles
+  uint64_t time_insert;
+  uint64_t time_other;
+  // log2 buckets of fault service time in cycles
+  uint64_t fault_hist[ZIO_FAULT_KINDS][ZIO_STATS_HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
+// elision decision state of one call site and size class
+struct zio_site_stats {
+  uint64_t key; // return address << 6 | log2 size class, 0 if unused
+  uint64_t elided_pages;
+  uint64_t faulted_pages;
+  uint64_t calls;
+  uint64_t skipped;
+} __attribute__((aligned(64)));
+
+struct zio_stats {
+  uint64_t magic;
+  uint64_t pid;
+  // tunables the copy decisions are made with
+  uint64_t elide_max_fault_pct;
+  uint64_t elide_warmup_pages;
+  // gauges
+  int64_t tracked_entries;
+  int64_t original_bytes; // bytes of originals kept alive for their copies
+  struct zio_site_stats sites[ZIO_STATS_SITES];
+  struct zio_thread_stats threads[ZIO_STATS_MAX_THREADS];
+};
+
+static inline int zio_site_copies(const struct zio_stats *st,
+                                  const struct zio_site_stats *e) {
+  return e->elided_pages >= st->elide_warmup_pages &&
+         e->faulted_pages * 100 > e->elided_pages * st->elide_max_fault_pct;
+}
+
+#endif /* ndef ZIO_STATS_H_ */
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zio_stats.h>
+
+/*
+ * Live view of the statistics exported by copy_interpose.so.
+ * Usage: zio-stat <pid> [interval seconds]
+ * Prints the totals once, or with an interval the change over every interval
+ * until the process exits.
+ */
+
+static void sum_threads(const struct zio_stats *st, struct zio_thread_stats *t)
+{
+  int i, k, b;
+
+  memset(t, 0, sizeof(*t));
+  for (i = 0; i < ZIO_STATS_MAX_THREADS; i++) {
+    const struct zio_thread_stats *s = &st->threads[i];
+    t->in_use += s->in_use;
+    t->fast_copies += s->fast_copies;
+    t->elided_bytes += s->elided_bytes;
+    t->slow_copies += s->slow_copies;
+    t->fast_writes += s->fast_writes;
+    t->slow_writes += s->slow_writes;
+    t->faults += s->faults;
+    t->fault_around_pages += s->fault_around_pages;
+    t->huge_faults += s->huge_faults;
+    t->moved_bytes += s->moved_bytes;
+    t->remapped_bytes += s->remapped_bytes;
+    t->zerocopy_sends += s->zerocopy_sends;
+    t->zerocopy_copied += s->zerocopy_copied;
+    t->time_search += s->time_search;
+    t->time_insert += s->time_insert;
+    t->time_other += s->time_other;
+    for (k = 0; k < ZIO_FAULT_KINDS; k++)
+      for (b = 0; b < ZIO_STATS_HIST_BUCKETS; b++)
+        t->fault_hist[k][b] += s->fault_hist[k][b];
+  }
+}
+
+static void print_hist(const char *name, const uint64_t *cur,
+                       const uint64_t *prev)
+{
+  uint64_t n = 0;
+  int b;
+
+  for (b = 0; b < ZIO_STATS_HIST_BUCKETS; b++)
+    n += cur[b] - prev[b];
+  if (!n)
+    return;
+  printf("%s fault service time (cycles, log2 buckets):\n", name);
+  for (b = 0; b < ZIO_STATS_HIST_BUCKETS; b++)
+    if (cur[b] != prev[b])
+      printf("  [%lu, %lu): %lu\n", 1UL << b, 2UL << b, cur[b] - prev[b]);
+}
+
+static void print_stats(const struct zio_stats *st,
+                        const struct zio_thread_stats *cur,
+                        const struct zio_thread_stats *prev)
+{
+  int i;
+
+  printf("threads: %u\ttracked buffers: %ld\toriginal bytes: %ld\n",
+         cur->in_use, st->tracked_entries, st->original_bytes);
+  printf("fast copies: %lu\tslow copies: %lu\telided bytes: %lu\t"
+         "fast writes: %lu\tslow writes: %lu\n",
+         cur->fast_copies - prev->fast_copies,
+         cur->slow_copies - prev->slow_copies,
+         cur->elided_bytes - prev->elided_bytes,
+         cur->fast_writes - prev->fast_writes,
+         cur->slow_writes - prev->slow_writes);
+  printf("page faults: %lu\tfault-around pages: %lu\thuge page faults: %lu\n",
+         cur->faults - prev->faults,
+         cur->fault_around_pages - prev->fault_around_pages,
+         cur->huge_faults - prev->huge_faults);
+  printf("realloc moved bytes: %lu\tremap moved bytes: %lu\n",
+         cur->moved_bytes - prev->moved_bytes,
+         cur->remapped_bytes - prev->remapped_bytes);
+  if (cur->zerocopy_sends)
+    printf("zerocopy sends: %lu\tcopied by the kernel: %lu\n",
+           cur->zerocopy_sends - prev->zerocopy_sends,
+           cur->zerocopy_copied - prev->zerocopy_copied);
+  print_hist("Missing", cur->fault_hist[ZIO_FAULT_MISSING],
+             prev->fault_hist[ZIO_FAULT_MISSING]);
+  print_hist("WP", cur->fault_hist[ZIO_FAULT_WP],
+             prev->fault_hist[ZIO_FAULT_WP]);
+
+  printf("Elision decisions (call site, size class, elided pages, "
+         "faulted pages, calls, skipped copies):\n");
+  for (i = 0; i < ZIO_STATS_SITES; i++) {
+    const struct zio_site_stats *e = &st->sites[i];
+    if (!e->calls && !e->elided_pages)
+      continue;
+    printf("  %p\t2^%lu\t%lu\t%lu\t%lu\t%lu\t%s\n",
+           i ? (void *)(e->key >> 6) : NULL, e->key & 63, e->elided_pages,
+           e->faulted_pages, e->calls, e->skipped,
+           zio_site_copies(st, e) ? "copy" : "elide");
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+  struct zio_thread_stats cur, prev;
+  const struct zio_stats *st;
+  char name[64];
+  int fd, interval;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s <pid> [interval seconds]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  interval = argc > 2 ? atoi(argv[2]) : 0;
+
+  snprintf(name, sizeof(name), ZIO_STATS_SHM_PREFIX "%s", argv[1]);
+  if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+    perror("shm_open failed");
+    return EXIT_FAILURE;
+  }
+  st = mmap(NULL, sizeof(*st), PROT_READ, MAP_SHARED, fd, 0);
+  if (st == MAP_FAILED) {
+    perror("mmap failed");
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  if (__atomic_load_n(&st->magic, __ATOMIC_ACQUIRE) != ZIO_STATS_MAGIC) {
+    fprintf(stderr, "%s is not a zIO statistics segment\n", name);
+    return EXIT_FAILURE;
+  }
+
+  memset(&prev, 0, sizeof(prev));
+  sum_threads(st, &cur);
+  print_stats(st, &cur, &prev);
+  while (interval > 0 && kill(st->pid, 0) == 0) {
+    sleep(interval);
+    prev = cur;
+    sum_threads(st, &cur);
+    printf("\n");
+    print_stats(st, &cur, &prev);
+  }
+  return EXIT_SUCCESS;
+}
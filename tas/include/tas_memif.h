@@ -212,7 +212,18 @@ struct flextcp_pl_appctx {
 /** Enable out of order receive processing members */
 #define FLEXNIC_PL_OOO_RECV 1
 
+/** Maximum number of out-of-order intervals per flow */
+#define FLEXNIC_PL_OOO_INTERVALS 4
+/** Maximum number of SACKed intervals per flow */
+#define FLEXNIC_PL_SACK_INTERVALS 4
+
+/** Selective retransmission after duplicate ACKs */
+#define FLEXNIC_PL_REXMIT_SACK 1
+/** Selective retransmission after a timeout */
+#define FLEXNIC_PL_REXMIT_RTO 2
+
 #define FLEXNIC_PL_FLOWST_SLOWPATH 1
+#define FLEXNIC_PL_FLOWST_SACK 2
 #define FLEXNIC_PL_FLOWST_ECN 8
 #define FLEXNIC_PL_FLOWST_TXFIN 16
 #define FLEXNIC_PL_FLOWST_RXFIN 32
@@ -274,11 +285,15 @@ struct flextcp_pl_flowst {
   uint32_t rx_dupack_cnt;
 
 #ifdef FLEXNIC_PL_OOO_RECV
-  /* Start of interval of out-of-order received data */
-  uint32_t rx_ooo_start;
-  /* Length of interval of out-of-order received data */
-  uint32_t rx_ooo_len;
+  /* Number of intervals of out-of-order received data in flowext */
+  uint16_t rx_ooo_cnt;
+  /* Interval in flowext that received data last */
+  uint16_t rx_ooo_last;
 #endif
+  /** Number of SACKed intervals in flowext */
+  uint16_t tx_sack_cnt;
+  /** Selective retransmission in progress (FLEXNIC_PL_REXMIT_*) */
+  uint16_t tx_rexmit;
 
   /** Number of bytes available to be sent */
   uint32_t tx_avail;
@@ -308,6 +323,32 @@ struct flextcp_pl_flowst {
 // 128
 } __attribute__((packed, aligned(64)));
 
+/** Interval of sequence numbers */
+struct flextcp_pl_seqint {
+  uint32_t start;
+  uint32_t len;
+} __attribute__((packed));
+
+/** Flow state registers beyond the cache lines of struct flextcp_pl_flowst,
+ * only used by optional fast path features */
+struct flextcp_pl_flowext {
+#ifdef FLEXNIC_PL_OOO_RECV
+  /** Out-of-order received data, the first rx_ooo_cnt intervals are valid,
+   * sorted by sequence number and neither overlapping nor adjacent */
+  struct flextcp_pl_seqint rx_ooo[FLEXNIC_PL_OOO_INTERVALS];
+#endif
+  /** Sent data the receiver reported in SACK blocks, the first tx_sack_cnt
+   * intervals are valid, sorted by sequence number */
+  struct flextcp_pl_seqint tx_sack[FLEXNIC_PL_SACK_INTERVALS];
+  /** Selective retransmission: next sequence number to consider */
+  uint32_t tx_rexmit_seq;
+  /** Selective retransmission: ends once acknowledged up to here */
+  uint32_t tx_rexmit_high;
+  /** Zero-copy TX: sequence number after the last byte sent so far, segments
+   * starting before it are retransmissions and get copied */
+  uint32_t tx_zc_max_seq;
+} __attribute__((packed));
+
 #define FLEXNIC_PL_FLOWHTE_VALID  (1 << 31)
 #define FLEXNIC_PL_FLOWHTE_POSSHIFT 29
 
@@ -338,6 +379,9 @@ struct flextcp_pl_mem {
   struct flextcp_pl_appst appst[FLEXNIC_PL_APPST_NUM];
 
   uint8_t flow_group_steering[FLEXNIC_PL_MAX_FLOWGROUPS];
+
+  /* extended flow state */
+  struct flextcp_pl_flowext flowext[FLEXNIC_PL_FLOWST_NUM];
 } __attribute__((packed));
 
 
@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <errno.h>
 #define __USE_GNU
@@ -64,6 +65,11 @@ long uffd = -1;
 
 pthread_t fault_thread, stats_thread;
 
+/* ZIO_FAULT_MODE=copy resolves faults with UFFDIO_COPY, which fills and wakes
+ * in one call, instead of mmap + UFFDIO_WAKE */
+int fault_mode_copy = 0;
+static char zero_page[4096] __attribute__((aligned(4096)));
+
 static inline void ensure_init(void);
 
 struct addr_encoding {
@@ -780,7 +786,8 @@ static void *bind_symbol(const char *sym)
   return ptr;
 }
 
-void handle_missing_fault(uint64_t page_boundary, uint32_t fault_flags)
+/* Returns whether the faulting page still has to be woken */
+int handle_missing_fault(uint64_t page_boundary, uint32_t fault_flags)
 {
 	snode* entry;
         int i = 0;
@@ -790,8 +797,25 @@ void handle_missing_fault(uint64_t page_boundary, uint32_t fault_flags)
 	LOG("handling fault at %p\n", page_boundary);
 	
 	num_faults++;
+	if (fault_mode_copy) {
+		struct uffdio_copy copy;
+		copy.dst = page_boundary;
+		copy.src = (uint64_t) zero_page;
+		copy.len = 4096;
+		copy.mode = 0;
+		// retry while the mapping changes under us, fall back to mmap
+		// if the page is not registered anymore
+		for (;;) {
+			if (ioctl(uffd, UFFDIO_COPY, &copy) == 0)
+				return 0;
+			if (copy.copy == -EEXIST)
+				return 1;
+			if (copy.copy != -EAGAIN)
+				break;
+		}
+	}
 	mmap((void*) page_boundary, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_POPULATE | MAP_ANONYMOUS, 0, 0);
-	return;
+	return 1;
 	
 	for(i = 1; i<50; i++){
 		base_addr = page_boundary - i*4096;
@@ -842,6 +866,7 @@ void handle_missing_fault(uint64_t page_boundary, uint32_t fault_flags)
 
 	skiplist_delete(&addr_list, base_addr);
 	num_faults++;
+	return 1;
 }
 
 void *print_stats(){
@@ -942,7 +967,8 @@ void *handle_fault()
 			page_boundry = fault_addr & ~(4096 - 1);
 
 			LOG("handling fault at %p, calling function %p\n", fault_addr, &handle_missing_fault);
-			handle_missing_fault(page_boundry, fault_flags);
+			if (!handle_missing_fault(page_boundry, fault_flags))
+				continue;
 
 		        range.start = (uint64_t)page_boundry;
 		        range.len = 4096;
@@ -1005,6 +1031,9 @@ static void init(void)
   //new tracking code
   skiplist_init(&addr_list);
 
+  char *mode = getenv("ZIO_FAULT_MODE");
+  fault_mode_copy = mode && strcmp(mode, "copy") == 0;
+
 #ifdef UFFD_PROTO
   uffd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
   if (uffd == -1) {
@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Runs two TAS instances on this host, linked by a shared memory (memif) device
+# instead of a NIC, with the micro_rpc echo benchmark between them. Both
+# instances print the packet rates of each fast path core every second
+# (--fp-stats): rx is poll_rx, qm is poll_qman, i.e. transmitted segments.
+#
+# Usage: sudo ./run_tas_memif.sh [FP-CORES] [MESSAGE-SIZE] [SECONDS]
+#
+# Needs tas/tas and lib/libtas_interpose.so built with the memif PMD (see
+# DPDK_SW_PMDS in the Makefile) and ../benchmarks/micro_rpc built. Each side runs
+# in its own IPC and mount namespace so that the two instances do not share
+# the TAS shared memory in /dev/shm.
+
+cores=${1:-1}
+size=${2:-64}
+secs=${3:-30}
+sock=/run/tas_memif.sock
+rpc=../benchmarks/micro_rpc
+
+rm -f $sock
+
+#The server side serves the memif socket, the client side connects to it.
+unshare --ipc --mount --propagation private sh -c "
+  mount -t tmpfs tmpfs /dev/shm
+  ./tas/tas --ip-addr=10.0.0.1/24 --fp-cores-max=$cores --fp-no-hugepages \
+    --fp-net=memif-server:$sock --fp-stats --dpdk-extra=--no-huge \
+    > tas_memif_server.log 2>&1 &
+  sleep 5
+  LD_PRELOAD=lib/libtas_interpose.so timeout $((secs + 10)) \
+    $rpc/echoserver_linux 1234 $cores $rpc/echoserver.conf 1024 $size" &
+
+sleep 2
+
+unshare --ipc --mount --propagation private sh -c "
+  mount -t tmpfs tmpfs /dev/shm
+  ./tas/tas --ip-addr=10.0.0.2/24 --fp-cores-max=$cores --fp-no-hugepages \
+    --fp-net=memif-client:$sock --fp-stats --dpdk-extra=--no-huge \
+    > tas_memif_client.log 2>&1 &
+  sleep 5
+  LD_PRELOAD=lib/libtas_interpose.so timeout $secs \
+    $rpc/testclient_linux 10.0.0.1 1234 $cores $rpc/testclient.conf $size"
+
+wait
+pkill -f 'tas/tas --ip-addr=10.0.0.[12]/24'
+
+echo "Fast path rates (last 5 seconds) of the server side:"
+grep '^dp stats' tas_memif_server.log | tail -$((5 * cores))
+echo "Fast path rates (last 5 seconds) of the client side:"
+grep '^dp stats' tas_memif_client.log | tail -$((5 * cores))
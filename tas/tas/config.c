@@ -72,6 +72,11 @@ enum cfg_params {
   CP_FP_NO_XSUMOFFLOAD,
   CP_FP_NO_AUTOSCALE,
   CP_FP_NO_HUGEPAGES,
+  CP_FP_NET,
+  CP_FP_STATS,
+  CP_FP_TX_BURST,
+  CP_FP_TX_ZEROCOPY,
+  CP_FP_TEST_LOSS,
   CP_KNI_NAME,
   CP_READY_FD,
   CP_DPDK_EXTRA,
@@ -193,6 +198,21 @@ static struct option opts[] = {
     { .name = "fp-no-hugepages",
       .has_arg = no_argument,
       .val = CP_FP_NO_HUGEPAGES },
+    { .name = "fp-net",
+      .has_arg = required_argument,
+      .val = CP_FP_NET },
+    { .name = "fp-stats",
+      .has_arg = no_argument,
+      .val = CP_FP_STATS },
+    { .name = "fp-tx-burst",
+      .has_arg = required_argument,
+      .val = CP_FP_TX_BURST },
+    { .name = "fp-tx-zerocopy",
+      .has_arg = no_argument,
+      .val = CP_FP_TX_ZEROCOPY },
+    { .name = "fp-test-loss",
+      .has_arg = required_argument,
+      .val = CP_FP_TEST_LOSS },
     { .name = "kni-name",
       .has_arg = required_argument,
       .val = CP_KNI_NAME },
@@ -217,6 +237,8 @@ static inline int parse_double(const char *s, double *pd);
 static inline int parse_cidr(char *s, uint32_t *ip, uint8_t *prefix);
 static inline int parse_route(char *s, struct configuration *c);
 static inline int parse_arg_append(char *s, struct configuration *c);
+static inline int parse_net_backend(char *s, struct configuration *c);
+static int net_backend_args(struct configuration *c);
 
 int config_parse(struct configuration *c, int argc, char *argv[])
 {
@@ -460,6 +482,35 @@ int config_parse(struct configuration *c, int argc, char *argv[])
       case CP_FP_NO_HUGEPAGES:
         c->fp_hugepages = 0;
         break;
+      case CP_FP_NET:
+        if (parse_net_backend(optarg, c) != 0) {
+          fprintf(stderr, "network backend parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_STATS:
+        c->fp_stats = 1;
+        break;
+      case CP_FP_TX_BURST:
+        /* the queue manager takes the chunk as 16 bits */
+        if (parse_int32(optarg, &c->fp_tx_burst) != 0 ||
+            c->fp_tx_burst < 1 || c->fp_tx_burst > 32)
+        {
+          fprintf(stderr, "fp tx burst parsing failed, must be 1-32\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_TX_ZEROCOPY:
+        c->fp_tx_zerocopy = 1;
+        break;
+      case CP_FP_TEST_LOSS:
+        if (parse_int32(optarg, &c->fp_test_loss) != 0 ||
+            c->fp_test_loss > 1000000)
+        {
+          fprintf(stderr, "fp test loss parsing failed, must be 0-1000000\n");
+          goto failed;
+        }
+        break;
 
       case CP_KNI_NAME:
         if (!(c->kni_name = strdup(optarg))) {
@@ -498,6 +549,10 @@ int config_parse(struct configuration *c, int argc, char *argv[])
     goto failed;
   }
 
+  if (net_backend_args(c) != 0) {
+    goto failed;
+  }
+
   if(c->ip == 0) {
     fprintf(stderr, "ip-addr is a required argument!\n");
   }
@@ -549,6 +604,12 @@ static int config_defaults(struct configuration *c, char *progname)
   c->fp_xsumoffload = 1;
   c->fp_autoscale = 1;
   c->fp_hugepages = 1;
+  c->fp_net = CONFIG_NET_DPDK;
+  c->fp_net_arg = NULL;
+  c->fp_stats = 0;
+  c->fp_tx_burst = 8;
+  c->fp_tx_zerocopy = 0;
+  c->fp_test_loss = 0;
   c->kni_name = NULL;
   c->ready_fd = -1;
   c->quiet = 0;
@@ -647,6 +708,22 @@ static void print_usage(struct configuration *c, char *progname)
           "[default: enabled]\n"
       "  --fp-no-hugepages           Disable hugepages for SHM "
           "[default: enabled]\n"
+      "  --fp-net=BACKEND            Network backend "
+          "[default: dpdk]\n"
+      "     Options: dpdk, memif-server[:SOCKET], memif-client[:SOCKET],\n"
+      "              af_packet:IFACE, af_xdp:IFACE, tap:IFACE, ring\n"
+      "     All but dpdk run without a NIC and imply --fp-no-ints and\n"
+      "     --fp-no-autoscale\n"
+      "  --fp-stats                  Print per core packet rates "
+          "[default: disabled]\n"
+      "  --fp-tx-burst=SEGMENTS      Max segments per flow and "
+          "activation [default: %"PRIu32"]\n"
+      "  --fp-tx-zerocopy            Send payload from the app buffer "
+          "[default: disabled]\n"
+      "     Needs TX checksum offload, and IOVA as VA for devices that "
+          "DMA\n"
+      "  --fp-test-loss=PPM          Drop sent packets, per million, "
+          "for testing [default: 0]\n"
       "  --dpdk-extra=ARG            Add extra DPDK argument\n"
       "\n"
       "Host kernel interface:\n"
@@ -670,7 +747,7 @@ static void print_usage(struct configuration *c, char *progname)
       (double) c->cc_timely_alpha / UINT32_MAX,
       (double) c->cc_timely_beta / UINT32_MAX, c->cc_timely_min_rtt,
       c->cc_timely_min_rate, c->arp_to, c->arp_to_max,
-      c->fp_cores_max);
+      c->fp_cores_max, c->fp_tx_burst);
 }
 
 static inline int parse_int64(const char *s, uint64_t *pi)
@@ -790,3 +867,110 @@ static inline int parse_arg_append(char *s, struct configuration *c)
 
   return 0;
 }
+
+static inline int parse_net_backend(char *s, struct configuration *c)
+{
+  char *colon;
+
+  /* split off interface or socket path */
+  if ((colon = strchr(s, ':')) != NULL) {
+    *colon = 0;
+  }
+
+  if (!strcmp(s, "dpdk")) {
+    c->fp_net = CONFIG_NET_DPDK;
+  } else if (!strcmp(s, "memif-server")) {
+    c->fp_net = CONFIG_NET_MEMIF_SERVER;
+  } else if (!strcmp(s, "memif-client")) {
+    c->fp_net = CONFIG_NET_MEMIF_CLIENT;
+  } else if (!strcmp(s, "af_packet")) {
+    c->fp_net = CONFIG_NET_AF_PACKET;
+  } else if (!strcmp(s, "af_xdp")) {
+    c->fp_net = CONFIG_NET_AF_XDP;
+  } else if (!strcmp(s, "tap")) {
+    c->fp_net = CONFIG_NET_TAP;
+  } else if (!strcmp(s, "ring")) {
+    c->fp_net = CONFIG_NET_RING;
+  } else {
+    fprintf(stderr, "parse_net_backend: unknown backend (%s)\n", s);
+    return -1;
+  }
+
+  free(c->fp_net_arg);
+  c->fp_net_arg = NULL;
+  if (colon != NULL && !(c->fp_net_arg = strdup(colon + 1))) {
+    fprintf(stderr, "parse_net_backend: strdup failed\n");
+    return -1;
+  }
+
+  switch (c->fp_net) {
+    case CONFIG_NET_AF_PACKET:
+    case CONFIG_NET_AF_XDP:
+    case CONFIG_NET_TAP:
+      if (c->fp_net_arg == NULL) {
+        fprintf(stderr, "parse_net_backend: %s needs an interface\n", s);
+        return -1;
+      }
+      break;
+    case CONFIG_NET_DPDK:
+    case CONFIG_NET_RING:
+      if (c->fp_net_arg != NULL) {
+        fprintf(stderr, "parse_net_backend: %s takes no argument\n", s);
+        return -1;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+/* Add the DPDK arguments that create the virtual device of the network
+ * backend. These devices support neither RX interrupts nor RSS redirection
+ * tables, so both are turned off. */
+static int net_backend_args(struct configuration *c)
+{
+  char vdev[256], prefix[64];
+  const char *sock = c->fp_net_arg ? c->fp_net_arg : "/run/tas_memif.sock";
+
+  switch (c->fp_net) {
+    case CONFIG_NET_DPDK:
+      return 0;
+    case CONFIG_NET_MEMIF_SERVER:
+    case CONFIG_NET_MEMIF_CLIENT:
+      snprintf(vdev, sizeof(vdev), "--vdev=net_memif0,role=%s,socket=%s",
+          c->fp_net == CONFIG_NET_MEMIF_SERVER ? "server" : "client", sock);
+      /* two instances on one host need separate dpdk runtime state */
+      snprintf(prefix, sizeof(prefix), "--file-prefix=tas_memif_%s",
+          c->fp_net == CONFIG_NET_MEMIF_SERVER ? "server" : "client");
+      if (parse_arg_append(prefix, c) != 0) {
+        return -1;
+      }
+      break;
+    case CONFIG_NET_AF_PACKET:
+      snprintf(vdev, sizeof(vdev), "--vdev=net_af_packet0,iface=%s,qpairs=%u",
+          c->fp_net_arg, c->fp_cores_max);
+      break;
+    case CONFIG_NET_AF_XDP:
+      snprintf(vdev, sizeof(vdev), "--vdev=net_af_xdp0,iface=%s,"
+          "queue_count=%u", c->fp_net_arg, c->fp_cores_max);
+      break;
+    case CONFIG_NET_TAP:
+      snprintf(vdev, sizeof(vdev), "--vdev=net_tap0,iface=%s", c->fp_net_arg);
+      break;
+    case CONFIG_NET_RING:
+      snprintf(vdev, sizeof(vdev), "--vdev=net_ring0");
+      break;
+  }
+
+  if (parse_arg_append("--no-pci", c) != 0 ||
+      parse_arg_append(vdev, c) != 0)
+  {
+    return -1;
+  }
+
+  c->fp_interrupts = 0;
+  c->fp_autoscale = 0;
+  return 0;
+}
@@ -36,6 +36,12 @@
 
 #define TCP_MSS 1448
 #define TCP_MAX_RTT 100000
+/** Queue manager chunk: bytes a flow may send per activation */
+#define TCP_TX_CHUNK (config.fp_tx_burst * TCP_MSS)
+/** Zero-copy TX: shorter payloads are copied */
+#define TCP_TXZC_MIN 512
+/** SACK blocks that fit into an ACK next to the timestamp option */
+#define TCP_SACK_BLOCKS 3
 
 //#define SKIP_ACK 1
 
@@ -59,18 +65,44 @@ static void flow_tx_read(struct flextcp_pl_flowst *fs, uint32_t pos,
     uint16_t len, void *dst);
 static void flow_rx_write(struct flextcp_pl_flowst *fs, uint32_t pos,
     uint16_t len, const void *src);
+static int seqint_add(struct flextcp_pl_seqint *ints, uint16_t *n,
+    uint16_t max, uint32_t base, uint32_t seq, uint32_t len);
 #ifdef FLEXNIC_PL_OOO_RECV
 static void flow_rx_seq_write(struct flextcp_pl_flowst *fs, uint32_t seq,
     uint16_t len, const void *src);
+static int flow_rx_ooo_add(struct flextcp_pl_flowst *fs, uint32_t seq,
+    uint16_t len);
+static uint32_t flow_rx_ooo_catchup(struct flextcp_pl_flowst *fs);
 #endif
 static void flow_tx_segment(struct dataplane_context *ctx,
     struct network_buf_handle *nbh, struct flextcp_pl_flowst *fs,
     uint32_t seq, uint32_t ack, uint32_t rxwnd, uint16_t payload,
     uint32_t payload_pos, uint32_t ts_echo, uint32_t ts_my, uint8_t fin);
-static void flow_tx_ack(struct dataplane_context *ctx, uint32_t seq,
-    uint32_t ack, uint32_t rxwnd, uint32_t echo_ts, uint32_t my_ts,
-    struct network_buf_handle *nbh, struct tcp_timestamp_opt *ts_opt);
+static void flow_tx_segment_copy(struct dataplane_context *ctx,
+    struct network_buf_handle *nbh, struct network_buf_handle *tmpl,
+    struct flextcp_pl_flowst *fs, uint32_t seq, uint16_t payload,
+    uint32_t payload_pos, uint8_t fin);
+static void flow_tx_ack(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs, uint32_t seq, uint32_t ack, uint32_t rxwnd,
+    uint32_t echo_ts, uint32_t my_ts, struct network_buf_handle *nbh,
+    struct tcp_timestamp_opt *ts_opt);
+static struct tcp_timestamp_opt *flow_tx_ack_sack(
+    struct flextcp_pl_flowst *fs, struct pkt_tcp *p);
 static void flow_reset_retransmit(struct flextcp_pl_flowst *fs);
+static void flow_tx_drop(struct flextcp_pl_flowst *fs);
+static void flow_sack_update(struct flextcp_pl_flowst *fs,
+    const struct tcp_sack_opt *sack);
+static void flow_sack_recovery(struct flextcp_pl_flowst *fs, uint16_t type);
+static uint32_t flow_sack_hole(struct flextcp_pl_flowst *fs, uint32_t *seq);
+static inline uint32_t flow_sack_next(struct flextcp_pl_flowst *fs);
+static uint32_t flow_sack_holes(struct flextcp_pl_flowst *fs);
+static uint16_t flow_tx_sack_rexmit(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs, struct network_buf_handle **nbhs,
+    uint16_t num, uint32_t max, uint32_t ts, uint32_t *bytes);
+static inline uint32_t flow_tx_pending(struct flextcp_pl_flowst *fs);
+static int flow_txzc_attach(struct dataplane_context *ctx,
+    struct network_buf_handle *nbh, struct flextcp_pl_flowst *fs,
+    uint32_t seq, uint16_t payload, uint32_t payload_pos);
 
 static inline void tcp_checksums(struct network_buf_handle *nbh,
     struct pkt_tcp *p, beui32_t ip_s, beui32_t ip_d, uint16_t l3_paylen);
@@ -102,12 +134,13 @@ void fast_flows_qman_pfbufs(struct dataplane_context *ctx, uint32_t *queues,
 
 
 int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
-    struct network_buf_handle *nbh, uint32_t ts)
+    uint16_t bytes, struct network_buf_handle **nbhs, uint16_t num,
+    uint32_t ts)
 {
   uint32_t flow_id = queue;
   struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
-  uint32_t avail, len, tx_pos, tx_seq, ack, rx_wnd;
-  uint16_t new_core;
+  uint32_t avail, len, total = 0, off, pos, tx_pos, tx_seq, ack, rx_wnd;
+  uint16_t new_core, seg_len, segs, first;
   uint8_t fin;
   int ret = 0;
 
@@ -135,10 +168,16 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
 
     util_flexnic_kick(&fp_state->kctx[new_core], ts);
 
-    ret = -1;
     goto unlock;
   }
 
+  /* selective retransmission: first resend what the receiver is missing */
+  segs = MIN(num, config.fp_tx_burst);
+  if (UNLIKELY(fs->tx_rexmit != 0)) {
+    ret = flow_tx_sack_rexmit(ctx, fs, nbhs, segs, bytes, ts, &total);
+    segs -= ret;
+  }
+
   /* calculate how much is available to be sent */
   avail = tcp_txavail(fs, NULL);
 
@@ -162,12 +201,12 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
   trace_event(FLEXNIC_PL_TREV_AFLOQMAN, sizeof(te_afloqman), &te_afloqman);
 #endif
 
-  /* if there is no data available, stop */
-  if (avail == 0) {
-    ret = -1;
-    goto unlock;
+  /* if there is no data available, no buffer or no chunk left, stop */
+  if (avail == 0 || segs == 0 || total >= bytes) {
+    goto handback;
   }
-  len = MIN(avail, TCP_MSS);
+  len = MIN(avail, MIN(bytes - total, segs * TCP_MSS));
+  total += len;
 
   /* state snapshot for creating segment */
   tx_seq = fs->tx_next_seq;
@@ -193,9 +232,33 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
     len--;
   }
 
-  /* send out segment */
-  flow_tx_segment(ctx, nbh, fs, tx_seq, ack, rx_wnd, len, tx_pos,
-      fs->tx_next_ts, ts, fin);
+  /* send out segments, all but the first copy the headers of the first */
+  first = ret;
+  seg_len = MIN(len, TCP_MSS);
+  flow_tx_segment(ctx, nbhs[first], fs, tx_seq, ack, rx_wnd, seg_len, tx_pos,
+      fs->tx_next_ts, ts, fin && seg_len == len);
+  for (off = seg_len, ret++; off < len; off += seg_len, ret++) {
+    seg_len = MIN(len - off, TCP_MSS);
+    pos = tx_pos + off;
+    if (pos >= fs->tx_len) {
+      pos -= fs->tx_len;
+    }
+    flow_tx_segment_copy(ctx, nbhs[ret], nbhs[first], fs, tx_seq + off,
+        seg_len, pos, fin && off + seg_len == len);
+  }
+
+handback:
+  /* out of buffers before the chunk was used up: hand the rest back to the
+   * queue manager, it already took it off the queue */
+  avail = flow_tx_pending(fs);
+  if (bytes > total && avail > 0) {
+    if (qman_set(&ctx->qman, flow_id, 0, MIN(avail, bytes - total), 0,
+          QMAN_ADD_AVAIL) != 0)
+    {
+      fprintf(stderr, "fast_flows_qman: qman_set failed, UNEXPECTED\n");
+      abort();
+    }
+  }
 unlock:
   fs_unlock(fs);
   return ret;
@@ -211,10 +274,10 @@ int fast_flows_qman_fwd(struct dataplane_context *ctx,
 
   fs_lock(fs);
 
-  avail = tcp_txavail(fs, NULL);
+  avail = flow_tx_pending(fs);
 
   /* re-arm queue manager */
-  if (qman_set(&ctx->qman, flow_id, fs->tx_rate, avail, TCP_MSS,
+  if (qman_set(&ctx->qman, flow_id, fs->tx_rate, avail, TCP_TX_CHUNK,
         QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
   {
     fprintf(stderr, "fast_flows_qman_fwd: qman_set failed, UNEXPECTED\n");
@@ -362,7 +425,7 @@ int fast_flows_packet(struct dataplane_context *ctx,
 
   /* calculate how much data is available to be sent before processing this
    * packet, to detect whether more data can be sent afterwards */
-  old_avail = tcp_txavail(fs, NULL);
+  old_avail = flow_tx_pending(fs);
 
   seq = f_beui32(p->tcp.seqno);
   ack = f_beui32(p->tcp.ackno);
@@ -405,13 +468,29 @@ int fast_flows_packet(struct dataplane_context *ctx,
 #endif
     }
 
+    /* update what the receiver reported to have beyond the ack */
+    if ((fs->rx_base_sp & FLEXNIC_PL_FLOWST_SACK) == FLEXNIC_PL_FLOWST_SACK &&
+        UNLIKELY(opts->sack != NULL || fs->tx_sack_cnt != 0 ||
+          fs->tx_rexmit != 0))
+    {
+      flow_sack_update(fs, opts->sack);
+    }
+
     /* duplicate ack */
     if (UNLIKELY(tx_bump != 0)) {
       fs->rx_dupack_cnt = 0;
     } else if (UNLIKELY(orig_payload == 0 && ++fs->rx_dupack_cnt >= 3)) {
-      /* reset to last acknowledged position */
-      flow_reset_retransmit(fs);
-      goto unlock;
+      if (fs->tx_rexmit != 0) {
+        /* already retransmitting selectively */
+        fs->rx_dupack_cnt = 0;
+      } else if (fs->tx_sack_cnt != 0) {
+        /* only retransmit what the receiver is missing */
+        flow_sack_recovery(fs, FLEXNIC_PL_REXMIT_SACK);
+      } else {
+        /* reset to last acknowledged position */
+        flow_reset_retransmit(fs);
+        goto unlock;
+      }
     }
   }
 
@@ -437,30 +516,12 @@ int fast_flows_packet(struct dataplane_context *ctx,
       goto unlock;
     }
 
-    /* otherwise check if we can add it to the out of order interval */
-    if (fs->rx_ooo_len == 0) {
-      fs->rx_ooo_start = seq;
-      fs->rx_ooo_len = payload_bytes;
-      flow_rx_seq_write(fs, seq, payload_bytes, payload);
-      /*fprintf(stderr, "created OOO interval (%p start=%u len=%u)\n",
-          fs, fs->rx_ooo_start, fs->rx_ooo_len);*/
-    } else if (seq + payload_bytes == fs->rx_ooo_start) {
-      /* TODO: those two overlap checks should be more sophisticated */
-      fs->rx_ooo_start = seq;
-      fs->rx_ooo_len += payload_bytes;
+    /* otherwise check if we can add it to the out of order intervals */
+    if (flow_rx_ooo_add(fs, seq, payload_bytes) == 0) {
       flow_rx_seq_write(fs, seq, payload_bytes, payload);
-      /*fprintf(stderr, "extended OOO interval (%p start=%u len=%u)\n",
-          fs, fs->rx_ooo_start, fs->rx_ooo_len);*/
-    } else if (fs->rx_ooo_start + fs->rx_ooo_len == seq) {
-      /* TODO: those two overlap checks should be more sophisticated */
-      fs->rx_ooo_len += payload_bytes;
-      flow_rx_seq_write(fs, seq, payload_bytes, payload);
-      /*fprintf(stderr, "extended OOO interval (%p start=%u len=%u)\n",
-          fs, fs->rx_ooo_start, fs->rx_ooo_len);*/
     } else {
-      /*fprintf(stderr, "Sad, no luck with OOO interval (%p ooo.start=%u "
-          "ooo.len=%u seq=%u bytes=%u)\n", fs, fs->rx_ooo_start,
-          fs->rx_ooo_len, seq, payload_bytes);*/
+      /*fprintf(stderr, "Sad, no OOO interval left (%p ooo.cnt=%u seq=%u "
+          "bytes=%u)\n", fs, fs->rx_ooo_cnt, seq, payload_bytes);*/
     }
     goto unlock;
   }
@@ -526,38 +587,8 @@ int fast_flows_packet(struct dataplane_context *ctx,
 #ifdef FLEXNIC_PL_OOO_RECV
     /* if we have out of order segments, check whether buffer is continuous
      * or superfluous */
-    if (UNLIKELY(fs->rx_ooo_len != 0)) {
-      if (tcp_trim_rxbuf(fs, fs->rx_ooo_start, fs->rx_ooo_len, &trim_start,
-            &trim_end) != 0) {
-          /*fprintf(stderr, "dropping ooo (%p ooo.start=%u ooo.len=%u seq=%u "
-              "len=%u next_seq=%u)\n", fs, fs->rx_ooo_start, fs->rx_ooo_len, seq,
-              payload_bytes, fs->rx_next_seq);*/
-        /* completely superfluous: drop out of order interval */
-        fs->rx_ooo_len = 0;
-      } else {
-        /* adjust based on overlap */
-        fs->rx_ooo_start += trim_start;
-        fs->rx_ooo_len -= trim_start + trim_end;
-        /*fprintf(stderr, "adjusting ooo (%p ooo.start=%u ooo.len=%u seq=%u "
-            "len=%u next_seq=%u)\n", fs, fs->rx_ooo_start, fs->rx_ooo_len, seq,
-            payload_bytes, fs->rx_next_seq);*/
-        if (fs->rx_ooo_len > 0 && fs->rx_ooo_start == fs->rx_next_seq) {
-          /* yay, we caught up, make continuous and drop OOO interval */
-          /*fprintf(stderr, "caught up with ooo buffer (%p start=%u len=%u)\n",
-              fs, fs->rx_ooo_start, fs->rx_ooo_len);*/
-
-          rx_bump += fs->rx_ooo_len;
-          fs->rx_avail -= fs->rx_ooo_len;
-          fs->rx_next_pos += fs->rx_ooo_len;
-          if (fs->rx_next_pos >= fs->rx_len) {
-            fs->rx_next_pos -= fs->rx_len;
-          }
-          assert(fs->rx_next_pos < fs->rx_len);
-          fs->rx_next_seq += fs->rx_ooo_len;
-
-          fs->rx_ooo_len = 0;
-        }
-      }
+    if (UNLIKELY(fs->rx_ooo_cnt != 0)) {
+      rx_bump += flow_rx_ooo_catchup(fs);
     }
 #endif
   }
@@ -565,7 +596,7 @@ int fast_flows_packet(struct dataplane_context *ctx,
   if ((TCPH_FLAGS(&p->tcp) & TCP_FIN) == TCP_FIN &&
       !(fs->rx_base_sp & FLEXNIC_PL_FLOWST_RXFIN))
   {
-    if (fs->rx_next_seq == f_beui32(p->tcp.seqno) + orig_payload && !fs->rx_ooo_len) {
+    if (fs->rx_next_seq == f_beui32(p->tcp.seqno) + orig_payload && !fs->rx_ooo_cnt) {
       fin_bump = 1;
       fs->rx_base_sp |= FLEXNIC_PL_FLOWST_RXFIN;
       /* FIN takes up sequence number space */
@@ -614,11 +645,11 @@ unlock:
   }
 
   /* Flow control: More receiver space? -> might need to start sending */
-  new_avail = tcp_txavail(fs, NULL);
+  new_avail = flow_tx_pending(fs);
   if (new_avail > old_avail) {
     /* update qman queue */
     if (qman_set(&ctx->qman, flow_id, fs->tx_rate, new_avail -
-          old_avail, TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK
+          old_avail, TCP_TX_CHUNK, QMAN_SET_RATE | QMAN_SET_MAXCHUNK
           | QMAN_ADD_AVAIL) != 0)
     {
       fprintf(stderr, "fast_flows_packet: qman_set 1 failed, UNEXPECTED\n");
@@ -628,7 +659,7 @@ unlock:
 
   /* if we need to send an ack, also send packet to TX pipeline to do so */
   if (trigger_ack) {
-    flow_tx_ack(ctx, fs->tx_next_seq, fs->rx_next_seq, fs->rx_avail,
+    flow_tx_ack(ctx, fs, fs->tx_next_seq, fs->rx_next_seq, fs->rx_avail,
         fs->tx_next_ts, ts, nbh, opts->ts);
   }
 
@@ -739,7 +770,7 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
   /* update queue manager queue */
   if (old_avail < new_avail) {
     if (qman_set(&ctx->qman, flow_id, fs->tx_rate, new_avail -
-          old_avail, TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK
+          old_avail, TCP_TX_CHUNK, QMAN_SET_RATE | QMAN_SET_MAXCHUNK
           | QMAN_ADD_AVAIL) != 0)
     {
       fprintf(stderr, "flast_flows_bump: qman_set 1 failed, UNEXPECTED\n");
@@ -790,7 +821,7 @@ void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id)
       uint32_t old_sent = fs->tx_sent;
       uint32_t old_pos = fs->tx_next_pos;*/
 
-  old_avail = tcp_txavail(fs, NULL);
+  old_avail = flow_tx_pending(fs);
 
   if (fs->tx_sent == 0) {
     /*fprintf(stderr, "fast_flows_retransmit: tx sent == 0\n");
@@ -804,8 +835,13 @@ void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id)
   }
 
 
-  flow_reset_retransmit(fs);
-  new_avail = tcp_txavail(fs, NULL);
+  if (fs->tx_sack_cnt != 0 && fs->tx_rexmit != FLEXNIC_PL_REXMIT_RTO) {
+    /* resend everything the receiver did not report, once per timeout */
+    flow_sack_recovery(fs, FLEXNIC_PL_REXMIT_RTO);
+  } else {
+    flow_reset_retransmit(fs);
+  }
+  new_avail = flow_tx_pending(fs);
 
   /*    fprintf(stderr, "fast_flows_retransmit: "
           "old_avail=%u new_avail=%u head=%u tx_next_seq=%u old_head=%u "
@@ -816,7 +852,8 @@ void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id)
   /* update queue manager */
   if (new_avail > old_avail) {
     if (qman_set(&ctx->qman, flow_id, fs->tx_rate, new_avail - old_avail,
-          TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL) != 0)
+          TCP_TX_CHUNK, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL)
+        != 0)
     {
       fprintf(stderr, "flast_flows_bump: qman_set 1 failed, UNEXPECTED\n");
       abort();
@@ -859,6 +896,47 @@ static void flow_rx_write(struct flextcp_pl_flowst *fs, uint32_t pos,
   }
 }
 
+/* Record [seq, seq + len) in the sorted intervals ints[0, *n), merging it
+ * with the intervals it overlaps or is adjacent to. Intervals and segment
+ * start at or after base. Returns the index of the interval holding the
+ * segment, or -1 if it needs a new interval but all max are taken. */
+static int seqint_add(struct flextcp_pl_seqint *ints, uint16_t *n,
+    uint16_t max, uint32_t base, uint32_t seq, uint32_t len)
+{
+  uint32_t a, b, s, e;
+  uint16_t i, j, cnt = *n;
+
+  /* offsets relative to base */
+  a = seq - base;
+  b = a + len;
+
+  /* skip intervals ending before the segment, then find the ones touching it
+   * (i to j - 1) */
+  for (i = 0; i < cnt && ints[i].start - base + ints[i].len < a; i++);
+  for (j = i; j < cnt && ints[j].start - base <= b; j++);
+
+  if (i == j) {
+    /* new interval, keep the older ones rather than dropping them */
+    if (cnt == max) {
+      return -1;
+    }
+    memmove(ints + i + 1, ints + i, (cnt - i) * sizeof(*ints));
+    ints[i].start = seq;
+    ints[i].len = len;
+    cnt++;
+  } else {
+    s = MIN(a, ints[i].start - base);
+    e = MAX(b, ints[j - 1].start - base + ints[j - 1].len);
+    ints[i].start = base + s;
+    ints[i].len = e - s;
+    memmove(ints + i + 1, ints + j, (cnt - j) * sizeof(*ints));
+    cnt -= j - i - 1;
+  }
+
+  *n = cnt;
+  return i;
+}
+
 #ifdef FLEXNIC_PL_OOO_RECV
 static void flow_rx_seq_write(struct flextcp_pl_flowst *fs, uint32_t seq,
     uint16_t len, const void *src)
@@ -870,6 +948,62 @@ static void flow_rx_seq_write(struct flextcp_pl_flowst *fs, uint32_t seq,
   assert(pos < fs->rx_len);
   flow_rx_write(fs, pos, len, src);
 }
+
+/* Record out-of-order received [seq, seq + len), merging it with the intervals
+ * it overlaps or is adjacent to. Returns 0 if recorded, != 0 if it needs a new
+ * interval but all are taken. */
+static int flow_rx_ooo_add(struct flextcp_pl_flowst *fs, uint32_t seq,
+    uint16_t len)
+{
+  struct flextcp_pl_seqint *ooo =
+    fp_state->flowext[fs - fp_state->flowst].rx_ooo;
+  uint16_t n = fs->rx_ooo_cnt;
+  int i;
+
+  /* everything is within the receive buffer after the next expected sequence
+   * number, keep the older intervals rather than reneging on them */
+  i = seqint_add(ooo, &n, FLEXNIC_PL_OOO_INTERVALS, fs->rx_next_seq, seq, len);
+  if (i < 0) {
+    return -1;
+  }
+
+  fs->rx_ooo_cnt = n;
+  fs->rx_ooo_last = i;
+  return 0;
+}
+
+/* After in order data was received: drop intervals covered by it and append
+ * the one it reached, if any. Returns the number of bytes appended. */
+static uint32_t flow_rx_ooo_catchup(struct flextcp_pl_flowst *fs)
+{
+  struct flextcp_pl_seqint *ooo =
+    fp_state->flowext[fs - fp_state->flowst].rx_ooo;
+  uint32_t bump = 0, len;
+  uint16_t i, n = fs->rx_ooo_cnt;
+
+  for (i = 0; i < n && (int32_t) (ooo[i].start - fs->rx_next_seq) <= 0; i++) {
+    /* completely superfluous: drop out of order interval */
+    if ((int32_t) (ooo[i].start + ooo[i].len - fs->rx_next_seq) <= 0) {
+      continue;
+    }
+
+    /* yay, we caught up, make continuous and drop OOO interval */
+    len = ooo[i].start + ooo[i].len - fs->rx_next_seq;
+    bump += len;
+    fs->rx_avail -= len;
+    fs->rx_next_pos += len;
+    if (fs->rx_next_pos >= fs->rx_len) {
+      fs->rx_next_pos -= fs->rx_len;
+    }
+    assert(fs->rx_next_pos < fs->rx_len);
+    fs->rx_next_seq += len;
+  }
+
+  memmove(ooo, ooo + i, (n - i) * sizeof(*ooo));
+  fs->rx_ooo_cnt = n - i;
+  fs->rx_ooo_last = (fs->rx_ooo_last >= i ? fs->rx_ooo_last - i : 0);
+  return bump;
+}
 #endif
 
 static void flow_tx_segment(struct dataplane_context *ctx,
@@ -925,8 +1059,10 @@ static void flow_tx_segment(struct dataplane_context *ctx,
   opt_ts->ts_val = t_beui32(ts_my);
   opt_ts->ts_ecr = t_beui32(ts_echo);
 
-  /* add payload if requested */
-  if (payload > 0) {
+  /* add payload if requested, attached in place if possible */
+  if (payload > 0 &&
+      flow_txzc_attach(ctx, nbh, fs, seq, payload, payload_pos) != 0)
+  {
     flow_tx_read(fs, payload_pos, payload, (uint8_t *) p + hdrs_len);
   }
 
@@ -952,9 +1088,57 @@ static void flow_tx_segment(struct dataplane_context *ctx,
   tx_send(ctx, nbh, 0, hdrs_len + payload);
 }
 
-static void flow_tx_ack(struct dataplane_context *ctx, uint32_t seq,
-    uint32_t ack, uint32_t rxwnd, uint32_t echots, uint32_t myts,
-    struct network_buf_handle *nbh, struct tcp_timestamp_opt *ts_opt)
+/* send the next segment of a burst, with the headers flow_tx_segment built in
+ * tmpl for the first one */
+static void flow_tx_segment_copy(struct dataplane_context *ctx,
+    struct network_buf_handle *nbh, struct network_buf_handle *tmpl,
+    struct flextcp_pl_flowst *fs, uint32_t seq, uint16_t payload,
+    uint32_t payload_pos, uint8_t fin)
+{
+  struct pkt_tcp *t = network_buf_buf(tmpl);
+  struct pkt_tcp *p = network_buf_buf(nbh);
+  uint16_t hdrs_len;
+
+  hdrs_len = sizeof(*p) + (TCPH_HDRLEN(&t->tcp) - 5) * 4;
+  memcpy(p, t, hdrs_len);
+
+  p->ip.len = t_beui16(hdrs_len - offsetof(struct pkt_tcp, ip) + payload);
+  p->tcp.seqno = t_beui32(seq);
+  if (fin) {
+    TCPH_HDRLEN_FLAGS_SET(&p->tcp, TCPH_HDRLEN(&p->tcp),
+        TCP_PSH | TCP_ACK | TCP_FIN);
+  }
+
+  if (flow_txzc_attach(ctx, nbh, fs, seq, payload, payload_pos) != 0) {
+    flow_tx_read(fs, payload_pos, payload, (uint8_t *) p + hdrs_len);
+  }
+
+  /* checksums */
+  tcp_checksums(nbh, p, fs->local_ip, fs->remote_ip, hdrs_len - offsetof(struct
+        pkt_tcp, tcp) + payload);
+
+#ifdef FLEXNIC_TRACING
+  struct flextcp_pl_trev_txseg te_txseg = {
+      .local_ip = f_beui32(p->ip.src),
+      .remote_ip = f_beui32(p->ip.dest),
+      .local_port = f_beui16(p->tcp.src),
+      .remote_port = f_beui16(p->tcp.dest),
+
+      .flow_seq = seq,
+      .flow_ack = f_beui32(p->tcp.ackno),
+      .flow_flags = TCPH_FLAGS(&p->tcp),
+      .flow_len = payload,
+    };
+  trace_event(FLEXNIC_PL_TREV_TXSEG, sizeof(te_txseg), &te_txseg);
+#endif
+
+  tx_send(ctx, nbh, 0, hdrs_len + payload);
+}
+
+static void flow_tx_ack(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs, uint32_t seq, uint32_t ack, uint32_t rxwnd,
+    uint32_t echots, uint32_t myts, struct network_buf_handle *nbh,
+    struct tcp_timestamp_opt *ts_opt)
 {
   struct pkt_tcp *p;
   struct eth_addr eth;
@@ -982,6 +1166,16 @@ static void flow_tx_ack(struct dataplane_context *ctx, uint32_t seq,
   p->tcp.src = p->tcp.dest;
   p->tcp.dest = port;
 
+#ifdef FLEXNIC_PL_OOO_RECV
+  /* tell the sender about out of order data, the received payload was already
+   * written to the receive buffer, the options can extend into it */
+  if (UNLIKELY(fs->rx_ooo_cnt != 0 &&
+        (fs->rx_base_sp & FLEXNIC_PL_FLOWST_SACK) != 0))
+  {
+    ts_opt = flow_tx_ack_sack(fs, p);
+  }
+#endif
+
   hdrlen = sizeof(*p) + (TCPH_HDRLEN(&p->tcp) - 5) * 4;
 
   /* If ECN flagged, set TCP response flag */
@@ -1027,6 +1221,50 @@ static void flow_tx_ack(struct dataplane_context *ctx, uint32_t seq,
   tx_send(ctx, nbh, network_buf_off(nbh), hdrlen);
 }
 
+#ifdef FLEXNIC_PL_OOO_RECV
+/* Replace the TCP options of an ACK with a timestamp and a SACK option for the
+ * out of order intervals, starting with the one that received data last.
+ * Returns the new timestamp option. */
+static struct tcp_timestamp_opt *flow_tx_ack_sack(
+    struct flextcp_pl_flowst *fs, struct pkt_tcp *p)
+{
+  struct flextcp_pl_seqint *ooo =
+    fp_state->flowext[fs - fp_state->flowst].rx_ooo;
+  uint8_t *opt = (uint8_t *) (p + 1);
+  struct tcp_timestamp_opt *opt_ts;
+  struct tcp_sack_opt *opt_sack;
+  uint16_t i, j, k, n, optlen;
+
+  n = MIN(fs->rx_ooo_cnt, TCP_SACK_BLOCKS);
+  optlen = 2 + sizeof(*opt_ts) + 2 + sizeof(*opt_sack) +
+    n * sizeof(struct tcp_sack_block);
+
+  opt[0] = opt[1] = TCP_OPT_NO_OP;
+  opt_ts = (struct tcp_timestamp_opt *) (opt + 2);
+  opt_ts->kind = TCP_OPT_TIMESTAMP;
+  opt_ts->length = sizeof(*opt_ts);
+
+  opt[2 + sizeof(*opt_ts)] = opt[3 + sizeof(*opt_ts)] = TCP_OPT_NO_OP;
+  opt_sack = (struct tcp_sack_opt *) (opt + 4 + sizeof(*opt_ts));
+  opt_sack->kind = TCP_OPT_SACK;
+  opt_sack->length = sizeof(*opt_sack) + n * sizeof(struct tcp_sack_block);
+
+  i = fs->rx_ooo_last;
+  opt_sack->blocks[0].start = t_beui32(ooo[i].start);
+  opt_sack->blocks[0].end = t_beui32(ooo[i].start + ooo[i].len);
+  for (j = 0, k = 1; k < n; j++) {
+    if (j != i) {
+      opt_sack->blocks[k].start = t_beui32(ooo[j].start);
+      opt_sack->blocks[k].end = t_beui32(ooo[j].start + ooo[j].len);
+      k++;
+    }
+  }
+
+  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, TCPH_FLAGS(&p->tcp));
+  return opt_ts;
+}
+#endif
+
 static void flow_reset_retransmit(struct flextcp_pl_flowst *fs)
 {
   uint32_t x;
@@ -1045,6 +1283,16 @@ static void flow_reset_retransmit(struct flextcp_pl_flowst *fs)
   fs->rx_remote_avail += fs->tx_sent;
   fs->tx_sent = 0;
 
+  /* everything is sent again, forget what the receiver reported */
+  fs->tx_sack_cnt = 0;
+  fs->tx_rexmit = 0;
+
+  flow_tx_drop(fs);
+}
+
+/* account a loss for congestion control */
+static void flow_tx_drop(struct flextcp_pl_flowst *fs)
+{
   /* cut rate by half if first drop in control interval */
   if (fs->cnt_tx_drops == 0) {
     fs->tx_rate /= 2;
@@ -1053,6 +1301,187 @@ static void flow_reset_retransmit(struct flextcp_pl_flowst *fs)
   fs->cnt_tx_drops++;
 }
 
+/* Update the SACK scoreboard after an ack: drop what is cumulatively
+ * acknowledged now and add the blocks of the SACK option, if any. Ends
+ * selective retransmission once everything sent before it started is
+ * acknowledged. */
+static void flow_sack_update(struct flextcp_pl_flowst *fs,
+    const struct tcp_sack_opt *sack)
+{
+  struct flextcp_pl_flowext *fe = &fp_state->flowext[fs - fp_state->flowst];
+  uint32_t start, end, una = fs->tx_next_seq - fs->tx_sent;
+  uint16_t i, nb, n = fs->tx_sack_cnt;
+
+  /* drop and trim intervals below the ack */
+  for (i = 0; i < n &&
+      (int32_t) (fe->tx_sack[i].start + fe->tx_sack[i].len - una) <= 0; i++);
+  memmove(fe->tx_sack, fe->tx_sack + i, (n - i) * sizeof(fe->tx_sack[0]));
+  n -= i;
+  if (n > 0 && (int32_t) (fe->tx_sack[0].start - una) < 0) {
+    fe->tx_sack[0].len -= una - fe->tx_sack[0].start;
+    fe->tx_sack[0].start = una;
+  }
+
+  /* add blocks, ignoring those not within unacknowledged sent data (e.g.
+   * duplicate SACKs); if all intervals are taken the rest is resent */
+  if (sack != NULL) {
+    nb = (sack->length - sizeof(*sack)) / sizeof(sack->blocks[0]);
+    for (i = 0; i < nb; i++) {
+      start = f_beui32(sack->blocks[i].start);
+      end = f_beui32(sack->blocks[i].end);
+      if ((int32_t) (start - una) <= 0 || (int32_t) (end - start) <= 0 ||
+          (int32_t) (end - fs->tx_next_seq) > 0)
+      {
+        continue;
+      }
+      seqint_add(fe->tx_sack, &n, FLEXNIC_PL_SACK_INTERVALS, una, start,
+          end - start);
+    }
+  }
+  fs->tx_sack_cnt = n;
+
+  if (fs->tx_rexmit != 0 && (int32_t) (una - fe->tx_rexmit_high) >= 0) {
+    fs->tx_rexmit = 0;
+  }
+}
+
+/* Start retransmitting only the holes in the scoreboard, from the ack up to
+ * the data sent so far. New data is sent after the holes. */
+static void flow_sack_recovery(struct flextcp_pl_flowst *fs, uint16_t type)
+{
+  struct flextcp_pl_flowext *fe = &fp_state->flowext[fs - fp_state->flowst];
+
+  fs->rx_dupack_cnt = 0;
+  fs->tx_rexmit = type;
+  fe->tx_rexmit_seq = fs->tx_next_seq - fs->tx_sent;
+  fe->tx_rexmit_high = fs->tx_next_seq;
+
+  flow_tx_drop(fs);
+}
+
+/* Find the first hole at or after *seq: data not SACKed below the highest
+ * SACKed byte, after a timeout also above it up to the data sent when
+ * recovery started. Moves *seq to its start and returns its length, 0 if
+ * there is none. */
+static uint32_t flow_sack_hole(struct flextcp_pl_flowst *fs, uint32_t *seq)
+{
+  struct flextcp_pl_flowext *fe = &fp_state->flowext[fs - fp_state->flowst];
+  uint32_t start, end;
+  uint16_t i;
+
+  for (i = 0; i < fs->tx_sack_cnt; i++) {
+    start = fe->tx_sack[i].start;
+    end = start + fe->tx_sack[i].len;
+    if ((int32_t) (*seq - start) < 0) {
+      return start - *seq;
+    }
+    if ((int32_t) (*seq - end) < 0) {
+      *seq = end;
+    }
+  }
+
+  if (fs->tx_rexmit == FLEXNIC_PL_REXMIT_RTO &&
+      (int32_t) (*seq - fe->tx_rexmit_high) < 0)
+  {
+    return fe->tx_rexmit_high - *seq;
+  }
+  return 0;
+}
+
+/* next sequence number selective retransmission considers */
+static inline uint32_t flow_sack_next(struct flextcp_pl_flowst *fs)
+{
+  uint32_t seq = fp_state->flowext[fs - fp_state->flowst].tx_rexmit_seq;
+  uint32_t una = fs->tx_next_seq - fs->tx_sent;
+
+  return ((int32_t) (seq - una) < 0 ? una : seq);
+}
+
+/* bytes selective retransmission still has to resend */
+static uint32_t flow_sack_holes(struct flextcp_pl_flowst *fs)
+{
+  uint32_t len, holes = 0, seq = flow_sack_next(fs);
+
+  while ((len = flow_sack_hole(fs, &seq)) > 0) {
+    holes += len;
+    seq += len;
+  }
+  return holes;
+}
+
+/* Resend holes in up to num segments of at most one MSS each, until *bytes
+ * reaches max. Adds the payload bytes to *bytes and returns the number of
+ * buffers used. */
+static uint16_t flow_tx_sack_rexmit(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs, struct network_buf_handle **nbhs,
+    uint16_t num, uint32_t max, uint32_t ts, uint32_t *bytes)
+{
+  struct flextcp_pl_flowext *fe = &fp_state->flowext[fs - fp_state->flowst];
+  uint32_t len, pos, diff, seq = flow_sack_next(fs);
+  uint16_t i;
+  uint8_t fin;
+
+  for (i = 0; i < num && *bytes < max && (len = flow_sack_hole(fs, &seq)) > 0;
+      i++)
+  {
+    len = MIN(len, MIN(TCP_MSS, max - *bytes));
+
+    /* position in the transmit buffer, counting back from the next byte */
+    diff = fs->tx_next_seq - seq;
+    pos = (fs->tx_next_pos >= diff ? fs->tx_next_pos - diff :
+        fs->tx_len - (diff - fs->tx_next_pos));
+
+    /* the last sequence number is the FIN, not a byte to send */
+    fin = (fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN) ==
+      FLEXNIC_PL_FLOWST_TXFIN && fs->tx_avail == 0 &&
+      seq + len == fs->tx_next_seq;
+
+    flow_tx_segment(ctx, nbhs[i], fs, seq, fs->rx_next_seq, fs->rx_avail,
+        len - fin, pos, fs->tx_next_ts, ts, fin);
+    seq += len;
+    *bytes += len;
+  }
+
+  fe->tx_rexmit_seq = seq;
+  return i;
+}
+
+/* bytes the queue manager should let this flow send: new data and holes */
+static inline uint32_t flow_tx_pending(struct flextcp_pl_flowst *fs)
+{
+  return tcp_txavail(fs, NULL) +
+    (UNLIKELY(fs->tx_rexmit != 0) ? flow_sack_holes(fs) : 0);
+}
+
+/* Attach the payload of a segment from the transmit buffer instead of
+ * copying it. Only first transmissions are attached: the peer cannot
+ * acknowledge them before the device has read them, so acknowledged bytes go
+ * back to the application right away. Retransmissions are rare and copied,
+ * as are short and wrapping payloads. Returns 0 if attached. */
+static int flow_txzc_attach(struct dataplane_context *ctx,
+    struct network_buf_handle *nbh, struct flextcp_pl_flowst *fs,
+    uint32_t seq, uint16_t payload, uint32_t payload_pos)
+{
+  struct flextcp_pl_flowext *fe = &fp_state->flowext[fs - fp_state->flowst];
+
+  if (!config.fp_tx_zerocopy) {
+    return -1;
+  }
+
+  /* segments starting before the last byte sent so far are retransmissions */
+  if ((int32_t) (seq - fe->tx_zc_max_seq) < 0) {
+    return -1;
+  }
+  fe->tx_zc_max_seq = seq + payload;
+
+  if (payload < TCP_TXZC_MIN || payload_pos + payload > fs->tx_len) {
+    return -1;
+  }
+
+  return network_buf_attach(&ctx->net, nbh,
+      dma_pointer(fs->tx_base + payload_pos, payload), payload);
+}
+
 static inline void tcp_checksums(struct network_buf_handle *nbh,
     struct pkt_tcp *p, beui32_t ip_s, beui32_t ip_d, uint16_t l3_paylen)
 {
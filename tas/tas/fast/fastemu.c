@@ -68,6 +68,7 @@ static inline void bufcache_free(struct dataplane_context *ctx,
     struct network_buf_handle *handle);
 
 static inline void tx_flush(struct dataplane_context *ctx);
+static void tx_test_loss(struct dataplane_context *ctx);
 static inline void tx_send(struct dataplane_context *ctx,
     struct network_buf_handle *nbh, uint16_t off, uint16_t len);
 
@@ -109,6 +110,11 @@ int dataplane_context_init(struct dataplane_context *ctx)
     return -1;
   }
 
+  /* test mode: per core loss, reproducible across runs */
+  if (config.fp_test_loss != 0) {
+    utils_rng_init(&ctx->loss_rng, ctx->id + 1);
+  }
+
   /* initialize queue manager */
   if (qman_thread_init(ctx) != 0) {
     fprintf(stderr, "initializing qman thread failed\n");
@@ -228,28 +234,37 @@ static inline uint64_t read_stat(uint64_t *p)
   return __sync_lock_test_and_set(p, 0);
 }
 
-void dataplane_dump_stats(void)
+void dataplane_dump_stats(uint64_t interval_us)
 {
   struct dataplane_context *ctx;
+  uint64_t rx, rx_cyc, qm, qm_cyc;
   unsigned i;
 
   for (i = 0; i < fp_cores_max; i++) {
-    ctx = ctxs[i];
+    if ((ctx = ctxs[i]) == NULL)
+      continue;
+
+    /* packets per us are Mpps */
+    rx = read_stat(&ctx->stat_rx_total);
+    rx_cyc = read_stat(&ctx->stat_cyc_rx);
+    qm = read_stat(&ctx->stat_qm_total);
+    qm_cyc = read_stat(&ctx->stat_cyc_qm);
     fprintf(stderr, "dp stats %u: "
-        "qm=(%"PRIu64",%"PRIu64",%"PRIu64")  "
-        "rx=(%"PRIu64",%"PRIu64",%"PRIu64")  "
-        "qs=(%"PRIu64",%"PRIu64",%"PRIu64")  "
-        "cyc=(%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64")\n", i,
-        read_stat(&ctx->stat_qm_poll), read_stat(&ctx->stat_qm_empty),
-        read_stat(&ctx->stat_qm_total),
+        "rx=%.3fMpps (%"PRIu64" cyc/pkt, polls=%"PRIu64" empty=%"PRIu64")  "
+        "qm=%.3fMpps (%"PRIu64" cyc/pkt, polls=%"PRIu64" empty=%"PRIu64")  "
+        "qs=(%"PRIu64",%"PRIu64",%"PRIu64")\n", i,
+        (double) rx / interval_us, rx ? rx_cyc / rx : 0,
         read_stat(&ctx->stat_rx_poll), read_stat(&ctx->stat_rx_empty),
-        read_stat(&ctx->stat_rx_total),
+        (double) qm / interval_us, qm ? qm_cyc / qm : 0,
+        read_stat(&ctx->stat_qm_poll), read_stat(&ctx->stat_qm_empty),
         read_stat(&ctx->stat_qs_poll), read_stat(&ctx->stat_qs_empty),
-        read_stat(&ctx->stat_qs_total),
-        read_stat(&ctx->stat_cyc_db), read_stat(&ctx->stat_cyc_qm),
-        read_stat(&ctx->stat_cyc_rx), read_stat(&ctx->stat_cyc_qs));
+        read_stat(&ctx->stat_qs_total));
   }
 }
+#else
+void dataplane_dump_stats(uint64_t interval_us)
+{
+}
 #endif
 
 static unsigned poll_rx(struct dataplane_context *ctx, uint32_t ts)
@@ -273,8 +288,8 @@ static unsigned poll_rx(struct dataplane_context *ctx, uint32_t ts)
     STATS_ADD(ctx, rx_empty, 1);
     return 0;
   }
-  STATS_ADD(ctx, rx_total, n);
   n = ret;
+  STATS_ADD(ctx, rx_total, n);
 
   /* prefetch packet contents (1st cache line) */
   for (i = 0; i < n; i++) {
@@ -411,7 +426,7 @@ static unsigned poll_qman(struct dataplane_context *ctx, uint32_t ts)
   uint16_t q_bytes[BATCH_SIZE];
   struct network_buf_handle **handles;
   uint16_t off = 0, max;
-  int ret, i, use;
+  int ret, i;
 
   max = BATCH_SIZE;
   if (TXBUF_SIZE - ctx->tx_num < max)
@@ -429,8 +444,6 @@ static unsigned poll_qman(struct dataplane_context *ctx, uint32_t ts)
     return 0;
   }
 
-  STATS_ADD(ctx, qm_total, ret);
-
   for (i = 0; i < ret; i++) {
     rte_prefetch0(handles[i]);
   }
@@ -448,13 +461,15 @@ static unsigned poll_qman(struct dataplane_context *ctx, uint32_t ts)
 
   fast_flows_qman_pfbufs(ctx, q_ids, ret);
 
+  /* a flow can send a burst of segments, but leaves a buffer for each of the
+   * flows after it */
   for (i = 0; i < ret; i++) {
-    use = fast_flows_qman(ctx, q_ids[i], handles[off], ts);
-
-    if (use == 0)
-     off++;
+    off += fast_flows_qman(ctx, q_ids[i], q_bytes[i], handles + off,
+        max - off - (ret - i - 1), ts);
   }
 
+  STATS_ADD(ctx, qm_total, off);
+
   /* apply buffer reservations */
   bufcache_alloc(ctx, off);
 
@@ -544,6 +559,11 @@ static inline void tx_flush(struct dataplane_context *ctx)
   int ret;
   unsigned i;
 
+  /* test mode: drop packets as if lost on the link */
+  if (UNLIKELY(config.fp_test_loss != 0)) {
+    tx_test_loss(ctx);
+  }
+
   if (ctx->tx_num == 0) {
     return;
   }
@@ -561,6 +581,24 @@ static inline void tx_flush(struct dataplane_context *ctx)
     }
     ctx->tx_num -= ret;
   }
+  ctx->loss_checked = ctx->tx_num;
+}
+
+/* Drop each packet queued since the last flush with probability
+ * config.fp_test_loss per million, packets still queued from an earlier
+ * flush were already considered. */
+static void tx_test_loss(struct dataplane_context *ctx)
+{
+  unsigned i, n;
+
+  for (i = n = ctx->loss_checked; i < ctx->tx_num; i++) {
+    if (utils_rng_gen32(&ctx->loss_rng) % 1000000 < config.fp_test_loss) {
+      network_free_pkts(1, &ctx->tx_handles[i]);
+    } else {
+      ctx->tx_handles[n++] = ctx->tx_handles[i];
+    }
+  }
+  ctx->tx_num = n;
 }
 
 static void poll_scale(struct dataplane_context *ctx)
@@ -54,7 +54,8 @@ void fast_flows_qman_pf(struct dataplane_context *ctx, uint32_t *queues,
 void fast_flows_qman_pfbufs(struct dataplane_context *ctx, uint32_t *queues,
     uint16_t n);
 int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
-    struct network_buf_handle *nbh, uint32_t ts);
+    uint16_t bytes, struct network_buf_handle **nbhs, uint16_t num,
+    uint32_t ts);
 int fast_flows_qman_fwd(struct dataplane_context *ctx,
     struct flextcp_pl_flowst *fs);
 int fast_flows_packet(struct dataplane_context *ctx,
@@ -24,6 +24,8 @@
 
 #include <stdio.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include <rte_config.h>
 #include <rte_memcpy.h>
@@ -36,6 +38,7 @@
 #include <rte_ip.h>
 #include <rte_version.h>
 #include <rte_spinlock.h>
+#include <rte_errno.h>
 
 #include <utils.h>
 #include <utils_rng.h>
@@ -85,6 +88,8 @@ static struct rte_eth_rss_reta_entry64 *rss_reta = NULL;
 static uint16_t *rss_core_buckets = NULL;
 
 static struct rte_mempool *mempool_alloc(void);
+static struct rte_mempool *ext_mempool_alloc(void);
+static int tx_zerocopy_map(void);
 static int reta_setup(void);
 static int reta_mlx5_resize(void);
 static rte_spinlock_t initlock = RTE_SPINLOCK_INITIALIZER;
@@ -134,11 +139,38 @@ int network_init(unsigned n_threads)
         "hash functions.\n");
     port_conf.rx_adv_conf.rss_conf.rss_hf &= eth_devinfo.flow_type_rss_offloads;
   }
+  if (port_conf.rx_adv_conf.rss_conf.rss_hf == 0)
+    port_conf.rxmode.mq_mode = ETH_MQ_RX_NONE;
+
+  /* software backends compute checksums in software */
+  if (config.fp_xsumoffload &&
+      (eth_devinfo.tx_offload_capa &
+       (DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM)) !=
+      (DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM))
+  {
+    fprintf(stderr, "Warning: device does not support TX checksum offload, "
+        "disabling it.\n");
+    config.fp_xsumoffload = 0;
+  }
+
+  /* zero-copy transmit chains header and payload mbufs, leaves the checksum
+   * of the payload to the device, and needs it to reach the app buffers */
+  if (config.fp_tx_zerocopy &&
+      (!config.fp_xsumoffload ||
+       !(eth_devinfo.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS) ||
+       tx_zerocopy_map() != 0))
+  {
+    fprintf(stderr, "Warning: device does not support zero-copy transmit, "
+        "disabling it.\n");
+    config.fp_tx_zerocopy = 0;
+  }
 
   /* enable per port checksum offload if requested */
   if (config.fp_xsumoffload)
     port_conf.txmode.offloads =
       DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM;
+  if (config.fp_tx_zerocopy)
+    port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
 
   /* disable rx interrupts if requested */
   if (!config.fp_interrupts)
@@ -169,6 +201,8 @@ int network_init(unsigned n_threads)
   if (config.fp_xsumoffload)
     eth_devinfo.default_txconf.offloads =
       DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM;
+  if (config.fp_tx_zerocopy)
+    eth_devinfo.default_txconf.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
 
   memcpy(&tas_info->mac_address, &eth_addr, 6);
 
@@ -212,6 +246,9 @@ int network_thread_init(struct dataplane_context *ctx)
   if ((t->pool = mempool_alloc()) == NULL) {
     goto error_mpool;
   }
+  if (config.fp_tx_zerocopy && (t->ext_pool = ext_mempool_alloc()) == NULL) {
+    goto error_mpool;
+  }
 
   /* initialize tx queue */
   t->queue_id = ctx->id;
@@ -311,6 +348,51 @@ static struct rte_mempool *mempool_alloc(void)
 
 }
 
+static struct rte_mempool *ext_mempool_alloc(void)
+{
+  static unsigned pool_id = 0;
+  unsigned n;
+  char name[32];
+  n = __sync_fetch_and_add(&pool_id, 1);
+  snprintf(name, 32, "ext_mbuf_pool_%u", n);
+  return rte_pktmbuf_pool_create(name, PERTHREAD_MBUFS, 32,
+      RTE_ALIGN(sizeof(struct network_extbuf), RTE_MBUF_PRIV_ALIGN), 0,
+      rte_socket_id());
+}
+
+/* register the shared memory with the app buffers for device DMA, with IO
+ * addresses equal to virtual addresses */
+static int tx_zerocopy_map(void)
+{
+  size_t pgsz = (config.fp_hugepages ? 2 * 1024 * 1024 :
+      sysconf(_SC_PAGESIZE));
+
+  if (rte_eal_iova_mode() != RTE_IOVA_VA) {
+    fprintf(stderr, "tx_zerocopy_map: needs --iova-mode=va\n");
+    return -1;
+  }
+
+  if (rte_extmem_register(tas_shm, FLEXNIC_DMA_MEM_SIZE, NULL, 0, pgsz)
+      != 0)
+  {
+    fprintf(stderr, "tx_zerocopy_map: rte_extmem_register failed (%d)\n",
+        rte_errno);
+    return -1;
+  }
+
+  /* devices without an IOMMU mapping of their own do not need this */
+  if (rte_dev_dma_map(eth_devinfo.device, tas_shm, (uintptr_t) tas_shm,
+        FLEXNIC_DMA_MEM_SIZE) != 0 && rte_errno != ENOTSUP)
+  {
+    fprintf(stderr, "tx_zerocopy_map: rte_dev_dma_map failed (%d)\n",
+        rte_errno);
+    rte_extmem_unregister(tas_shm, FLEXNIC_DMA_MEM_SIZE);
+    return -1;
+  }
+
+  return 0;
+}
+
 static inline uint16_t core_min(uint16_t num)
 {
   uint16_t i, i_min = 0, v_min = UINT8_MAX;
@@ -79,13 +79,56 @@ static inline void network_buf_setoff(struct network_buf_handle *bh,
   ((struct rte_mbuf *) bh)->data_off = off;
 }
 
+/* len covers segments attached with network_buf_attach */
 static inline void network_buf_setlen(struct network_buf_handle *bh,
     uint16_t len)
 {
   struct rte_mbuf *mb = (struct rte_mbuf *) bh;
-  mb->pkt_len = mb->data_len = len;
+  mb->data_len = len - (mb->pkt_len - mb->data_len);
+  mb->pkt_len = len;
 }
 
+/** Private area of mbufs in the ext_pool */
+struct network_extbuf {
+  struct rte_mbuf_ext_shared_info shinfo;
+};
+
+/* The attached memory stays with its owner, nothing to free */
+static inline void network_extbuf_free(void *addr, void *opaque)
+{
+}
+
+/**
+ * Attach len bytes at addr as a second segment of bh instead of copying them.
+ * The memory must be registered for device access and stay unmodified until
+ * the device has read it.
+ *
+ * @return 0 on success, -1 if no mbuf is available.
+ */
+static inline int network_buf_attach(struct network_thread *t,
+    struct network_buf_handle *bh, void *addr, uint16_t len)
+{
+  struct rte_mbuf *mb = (struct rte_mbuf *) bh;
+  struct rte_mbuf *eb;
+  struct network_extbuf *x;
+
+  if ((eb = rte_pktmbuf_alloc(t->ext_pool)) == NULL) {
+    return -1;
+  }
+
+  x = rte_mbuf_to_priv(eb);
+  x->shinfo.free_cb = network_extbuf_free;
+  x->shinfo.fcb_opaque = NULL;
+  rte_mbuf_ext_refcnt_set(&x->shinfo, 1);
+  rte_pktmbuf_attach_extbuf(eb, addr, (rte_iova_t) (uintptr_t) addr, len,
+      &x->shinfo);
+  eb->pkt_len = eb->data_len = len;
+
+  mb->next = eb;
+  mb->nb_segs = 2;
+  mb->pkt_len += len;
+  return 0;
+}
 
 static inline int network_poll(struct network_thread *t, unsigned num,
     struct network_buf_handle **bhs)
@@ -153,6 +196,16 @@ static inline void network_free(unsigned num, struct network_buf_handle **bufs)
   }
 }
 
+/** Free packets including payload segments attached to them */
+static inline void network_free_pkts(unsigned num,
+    struct network_buf_handle **bufs)
+{
+  unsigned i;
+  for (i = 0; i < num; i++) {
+    rte_pktmbuf_free((struct rte_mbuf *) bufs[i]);
+  }
+}
+
 /** calculate ip pseudo header xsum */
 static inline uint16_t network_ip_phdr_xsum(beui32_t ip_src, beui32_t ip_dst,
     uint8_t proto, uint16_t l3_paylen)
@@ -39,6 +39,24 @@ enum config_cc_algorithm {
   CONFIG_CC_CONST_RATE,
 };
 
+/** Network backends of the fast path. */
+enum config_net_backend {
+  /** DPDK device picked by the EAL, e.g. a NIC bound to a DPDK driver */
+  CONFIG_NET_DPDK,
+  /** Shared memory link (memif) to another instance, this one serving */
+  CONFIG_NET_MEMIF_SERVER,
+  /** Shared memory link (memif) to another instance, this one connecting */
+  CONFIG_NET_MEMIF_CLIENT,
+  /** AF_PACKET socket on a Linux interface */
+  CONFIG_NET_AF_PACKET,
+  /** AF_XDP socket on a Linux interface */
+  CONFIG_NET_AF_XDP,
+  /** New Linux tap interface */
+  CONFIG_NET_TAP,
+  /** In-memory rings that loop transmitted frames back */
+  CONFIG_NET_RING,
+};
+
 /** Struct containing the parsed configuration parameters */
 struct configuration {
   /** Kernel nic receive queue length. */
@@ -119,6 +137,18 @@ struct configuration {
   uint32_t fp_autoscale;
   /** FP: use huge pages for internal and buffer memory */
   uint32_t fp_hugepages;
+  /** FP: network backend */
+  enum config_net_backend fp_net;
+  /** FP: interface or socket path of the network backend */
+  char *fp_net_arg;
+  /** FP: print per core packet rates every second */
+  uint32_t fp_stats;
+  /** FP: max segments a flow sends per queue manager activation */
+  uint32_t fp_tx_burst;
+  /** FP: attach transmit payload to packets instead of copying it */
+  uint32_t fp_tx_zerocopy;
+  /** FP: test mode, drop transmitted packets with this rate per million */
+  uint32_t fp_test_loss;
   /** SP: kni interface name */
   char *kni_name;
   /** Ready signal fd */
@@ -40,6 +40,8 @@
 
 struct network_thread {
   struct rte_mempool *pool;
+  /** mbufs without data room for attaching payload, if zero-copy TX */
+  struct rte_mempool *ext_pool;
   uint16_t queue_id;
 };
 
@@ -82,6 +84,12 @@ struct dataplane_context {
   struct network_buf_handle *tx_handles[TXBUF_SIZE];
   uint16_t tx_num;
 
+  /********************************************************/
+  /* test mode: packet loss */
+  struct utils_rng loss_rng;
+  /** packets at the front of the send buffer already considered for loss */
+  uint16_t loss_checked;
+
   /********************************************************/
   /* polling queues */
   uint32_t poll_next_ctx;
@@ -123,8 +131,5 @@ int dataplane_init(void);
 int dataplane_context_init(struct dataplane_context *ctx);
 void dataplane_context_destroy(struct dataplane_context *ctx);
 void dataplane_loop(struct dataplane_context *ctx);
-#ifdef DATAPLANE_STATS
-void dataplane_dump_stats(void);
-#endif
 
 #endif /* ndef FASTPATH_H_ */
@@ -51,6 +51,9 @@ void shm_set_ready(void);
 int network_init(unsigned num_threads);
 void network_cleanup(void);
 
+/* print per core packet rates of the fast path since the last call */
+void dataplane_dump_stats(uint64_t interval_us);
+
 /* used by trace and shm */
 void *util_create_shmsiszed(const char *name, size_t size, void *addr);
 
@@ -111,6 +111,8 @@ int nicif_appctx_add(uint16_t appid, uint32_t db, uint64_t *rxq_base,
 enum nicif_connection_flags {
   /** Enable ECN for connection. */
   NICIF_CONN_ECN        = (1 <<  2),
+  /** Enable SACK for connection. */
+  NICIF_CONN_SACK       = (1 <<  3),
 };
 
 /**
@@ -189,6 +189,9 @@ int slowpath_main(void)
             kstats.acks);
         fflush(stdout);
       }
+      if (config.fp_stats) {
+        dataplane_dump_stats(cur_ts - last_print);
+      }
       last_print = cur_ts;
     }
   }
@@ -180,6 +180,7 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
     uint32_t *pf_id)
 {
   struct flextcp_pl_flowst *fs;
+  struct flextcp_pl_flowext *fe;
   beui32_t lip = t_beui32(ip_local), rip = t_beui32(ip_remote);
   beui16_t lp = t_beui16(port_local), rp = t_beui16(port_remote);
   uint32_t i, d, f_id, hash;
@@ -204,6 +205,9 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
   if ((flags & NICIF_CONN_ECN) == NICIF_CONN_ECN) {
     rx_base |= FLEXNIC_PL_FLOWST_ECN;
   }
+  if ((flags & NICIF_CONN_SACK) == NICIF_CONN_SACK) {
+    rx_base |= FLEXNIC_PL_FLOWST_SACK;
+  }
 
   fs = &fp_state->flowst[f_id];
   fs->opaque = app_opaque;
@@ -227,15 +231,21 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
   fs->rx_next_pos = 0;
   fs->rx_next_seq = remote_seq;
   fs->rx_remote_avail = rx_len; /* XXX */
+  fs->rx_ooo_cnt = 0;
 
   fs->tx_sent = 0;
   fs->tx_next_pos = 0;
   fs->tx_next_seq = local_seq;
   fs->tx_avail = 0;
   fs->tx_next_ts = 0;
+  fs->tx_sack_cnt = 0;
+  fs->tx_rexmit = 0;
   fs->tx_rate = rate;
   fs->rtt_est = 0;
 
+  fe = &fp_state->flowext[f_id];
+  fe->tx_zc_max_seq = local_seq;
+
   /* write to empty entry first */
   MEM_BARRIER();
   hte[i].flow_hash = hash;
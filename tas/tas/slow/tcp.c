@@ -71,6 +71,7 @@ struct backlog_slot {
 struct tcp_opts {
   struct tcp_mss_opt *mss;
   struct tcp_timestamp_opt *ts;
+  struct tcp_sack_permitted_opt *sack_perm;
 };
 
 static int conn_arp_done(struct connection *conn);
@@ -96,7 +97,7 @@ static void listener_accept(struct listener *l);
 
 static inline uint16_t port_alloc(void);
 static inline int send_control(const struct connection *conn, uint16_t flags,
-    int ts_opt, uint32_t ts_echo, uint16_t mss_opt);
+    int ts_opt, uint32_t ts_echo, uint16_t mss_opt, int sack_opt);
 static inline int send_reset(const struct pkt_tcp *p,
     const struct tcp_opts *opts);
 static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
@@ -410,7 +411,7 @@ int tcp_close(struct connection *conn)
   conn->local_seq = tx_seq;
 
   if (!tx_c || !rx_c) {
-    send_control(conn, TCP_RST, 0, 0, 0);
+    send_control(conn, TCP_RST, 0, 0, 0, 0);
   }
 
   cc_conn_remove(conn);
@@ -463,7 +464,7 @@ void tcp_timeout(struct timeout *to, enum timeout_type type)
   conn_timeout_arm(c, TO_TCP_HANDSHAKE);
 
   /* re-send SYN packet */
-  send_control(c, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, TCP_MSS);
+  send_control(c, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, TCP_MSS, 1);
 }
 
 static void conn_packet(struct connection *c, const struct pkt_tcp *p,
@@ -498,7 +499,8 @@ static void conn_packet(struct connection *c, const struct pkt_tcp *p,
     }
 
     send_control(c, TCP_SYN | TCP_ACK | ecn_flags, 1,
-        f_beui32(opts->ts->ts_val), TCP_MSS);
+        f_beui32(opts->ts->ts_val), TCP_MSS,
+        (c->flags & NICIF_CONN_SACK) == NICIF_CONN_SACK);
   } else if (c->status == CONN_OPEN &&
       (TCPH_FLAGS(&p->tcp) & TCP_SYN) == TCP_SYN)
   {
@@ -508,7 +510,7 @@ static void conn_packet(struct connection *c, const struct pkt_tcp *p,
   {
    /* silently ignore a FIN for an already closed connection: TODO figure out
     * why necessary*/
-    send_control(c, TCP_ACK, 1, 0, 0);
+    send_control(c, TCP_ACK, 1, 0, 0, 0);
   } else {
     fprintf(stderr, "tcp_packet: unexpected connection state %u\n", c->status);
   }
@@ -526,7 +528,7 @@ static int conn_arp_done(struct connection *conn)
   conn_timeout_arm(conn, TO_TCP_HANDSHAKE);
 
   /* send SYN */
-  send_control(conn, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, TCP_MSS);
+  send_control(conn, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, TCP_MSS, 1);
 
   CONN_DEBUG0(conn, "SYN SENT\n");
   return 0;
@@ -561,6 +563,11 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
     c->flags |= NICIF_CONN_ECN;
   }
 
+  /* enable SACK if SYN-ACK confirms */
+  if (opts->sack_perm != NULL) {
+    c->flags |= NICIF_CONN_SACK;
+  }
+
   cc_conn_init(c);
 
   c->comp.q = &conn_async_q;
@@ -583,7 +590,7 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
   c->status = CONN_OPEN;
 
   /* send ACK */
-  send_control(c, TCP_ACK, 1, c->syn_ts, 0);
+  send_control(c, TCP_ACK, 1, c->syn_ts, 0, 0);
 
   CONN_DEBUG0(c, "conn_syn_sent_packet: ACK sent\n");
 
@@ -603,7 +610,8 @@ static int conn_reg_synack(struct connection *c)
   }
 
   /* send ACK */
-  send_control(c, TCP_SYN | TCP_ACK | ecn_flags, 1, c->syn_ts, TCP_MSS);
+  send_control(c, TCP_SYN | TCP_ACK | ecn_flags, 1, c->syn_ts, TCP_MSS,
+      (c->flags & NICIF_CONN_SACK) == NICIF_CONN_SACK);
 
   appif_accept_conn(c, 0);
 
@@ -932,6 +940,11 @@ static void listener_accept(struct listener *l)
     c->flags |= NICIF_CONN_ECN;
   }
 
+  /* check if SACK is offered */
+  if (opts.sack_perm != NULL) {
+    c->flags |= NICIF_CONN_SACK;
+  }
+
   cc_conn_init(c);
 
   c->status = CONN_REG_SYNACK;
@@ -966,19 +979,22 @@ out:
 static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
     uint16_t remote_port, uint16_t local_port, uint32_t local_seq,
     uint32_t remote_seq, uint16_t flags, int ts_opt, uint32_t ts_echo,
-    uint16_t mss_opt)
+    uint16_t mss_opt, int sack_opt)
 {
   uint32_t new_tail;
   struct pkt_tcp *p;
   struct tcp_mss_opt *opt_mss;
+  struct tcp_sack_permitted_opt *opt_sack;
   struct tcp_timestamp_opt *opt_ts;
   uint8_t optlen;
-  uint16_t len, off_ts, off_mss;
+  uint16_t len, off_ts, off_mss, off_sack;
 
   /* calculate header length depending on options */
   optlen = 0;
   off_mss = optlen;
   optlen += (mss_opt ? sizeof(*opt_mss) : 0);
+  off_sack = optlen;
+  optlen += (sack_opt ? sizeof(*opt_sack) : 0);
   off_ts = optlen;
   optlen += (ts_opt ? sizeof(*opt_ts) : 0);
   optlen = (optlen + 3) & ~3;
@@ -1017,6 +1033,9 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
   p->tcp.chksum = 0;
   p->tcp.urgp = t_beui16(0);
 
+  /* padding after the last option */
+  memset(p + 1, 0, optlen);
+
   /* if requested: add mss option */
   if (mss_opt) {
     opt_mss = (struct tcp_mss_opt *) ((uint8_t *) (p + 1) + off_mss);
@@ -1025,10 +1044,17 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
     opt_mss->mss = t_beui16(mss_opt);
   }
 
+  /* if requested: add sack permitted option */
+  if (sack_opt) {
+    opt_sack = (struct tcp_sack_permitted_opt *)
+      ((uint8_t *) (p + 1) + off_sack);
+    opt_sack->kind = TCP_OPT_SACK_PERMITTED;
+    opt_sack->length = sizeof(*opt_sack);
+  }
+
   /* if requested: add timestamp option */
   if (ts_opt) {
     opt_ts = (struct tcp_timestamp_opt *) ((uint8_t *) (p + 1) + off_ts);
-    memset(opt_ts, 0, optlen);
     opt_ts->kind = TCP_OPT_TIMESTAMP;
     opt_ts->length = sizeof(*opt_ts);
     opt_ts->ts_val = t_beui32(0);
@@ -1045,11 +1071,11 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
 }
 
 static inline int send_control(const struct connection *conn, uint16_t flags,
-    int ts_opt, uint32_t ts_echo, uint16_t mss_opt)
+    int ts_opt, uint32_t ts_echo, uint16_t mss_opt, int sack_opt)
 {
   return send_control_raw(conn->remote_mac, conn->remote_ip, conn->remote_port,
       conn->local_port, conn->local_seq, conn->remote_seq, flags, ts_opt,
-      ts_echo, mss_opt);
+      ts_echo, mss_opt, sack_opt);
 }
 
 static inline int send_reset(const struct pkt_tcp *p,
@@ -1067,7 +1093,7 @@ static inline int send_reset(const struct pkt_tcp *p,
   memcpy(&remote_mac, &p->eth.src, ETH_ADDR_LEN);
   return send_control_raw(remote_mac, f_beui32(p->ip.src), f_beui16(p->tcp.src),
       f_beui16(p->tcp.dest), f_beui32(p->tcp.ackno), f_beui32(p->tcp.seqno) + 1,
-      TCP_RST | TCP_ACK, ts_opt, ts_val, 0);
+      TCP_RST | TCP_ACK, ts_opt, ts_val, 0, 0);
 }
 
 static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
@@ -1080,6 +1106,7 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
 
   opts->ts = NULL;
   opts->mss = NULL;
+  opts->sack_perm = NULL;
 
   /* whole header not in buf */
   if (TCPH_HDRLEN(&p->tcp) < 5 || opts_len > (len - sizeof(*p))) {
@@ -1116,6 +1143,15 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
         }
 
         opts->ts = (struct tcp_timestamp_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_SACK_PERMITTED) {
+        if (opt_len != sizeof(struct tcp_sack_permitted_opt)) {
+          fprintf(stderr, "parse_options: sack permitted option size wrong "
+              "(expect %zu got %u)\n", sizeof(struct tcp_sack_permitted_opt),
+              opt_len);
+          return -1;
+        }
+
+        opts->sack_perm = (struct tcp_sack_permitted_opt *) (opt + off);
       }
     }
     off += opt_len;
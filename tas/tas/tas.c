@@ -41,8 +41,9 @@
 #include <utils_timeout.h>
 
 #include <tas.h>
-#include <fastpath.h>
+/* before fastpath.h, it sets the stats fields of struct dataplane_context */
 #include "fast/internal.h"
+#include <fastpath.h>
 
 struct core_load {
   uint64_t cyc_busy;
@@ -55,7 +55,8 @@ static int simple_cmd(const char *path, char * const args[])
   }
 }
 
-static pid_t start_tas(void)
+/* start TAS with an optional extra argument */
+static pid_t start_tas(const char *extra)
 {
   int ready_fd, ret;
   pid_t pid;
@@ -75,10 +76,9 @@ static pid_t start_tas(void)
   if (pid == 0) {
     /* in child */
     execl("tas/tas", "--fp-cores-max=1", "--fp-no-ints", "--fp-no-xsumoffload",
-        "--fp-no-autoscale", "--fp-no-hugepages", "--dpdk-extra=--vdev",
-        "--dpdk-extra=eth_tap0,iface=vethtas1",
+        "--fp-no-autoscale", "--fp-no-hugepages", "--fp-net=tap:vethtas1",
         "--dpdk-extra=--no-shconf", "--dpdk-extra=--no-huge",
-        "--ip-addr=192.168.1.1/24", readyfdopt, NULL);
+        "--ip-addr=192.168.1.1/24", readyfdopt, extra, NULL);
 
     perror("exec failed");
     exit(1);
@@ -104,21 +104,17 @@ out_error:
   return -1;
 }
 
-static int test_1(void *data)
+/* Connect a non-blocking Linux socket to a listener on TAS, started before,
+ * and accept it on a new TAS context. Returns 0 on success. */
+static int connect_tas(struct flextcp_context *context,
+    struct flextcp_connection *conn, int *psock)
 {
   static char *ip_addr_cmd[] = {"ip", "addr", "add", "192.168.1.2/24", "dev",
     "vethtas1", NULL };
   static char *ip_up_cmd[] = {"ip", "link", "set", "vethtas1", "up", NULL };
-
-  pid_t tas_pid, npid;
+  static struct flextcp_listener listen;
   int nret, ret = 0;
 
-  /* start tas */
-  if ((tas_pid = start_tas()) < 0) {
-    fprintf(stderr, "start_tas failed\n");
-    return 1;
-  }
-
   /* set ip address for TAS interface and bring it up */
   if (simple_cmd(ip_addr_cmd[0], ip_addr_cmd) != 0) {
     fprintf(stderr, "ip addr failed\n");
@@ -137,16 +133,14 @@ static int test_1(void *data)
   }
 
   /* create context */
-  struct flextcp_context context;
-  if (flextcp_context_create(&context) != 0) {
+  if (flextcp_context_create(context) != 0) {
     fprintf(stderr, "flextcp_context_create failed\n");
     ret = 1;
     goto out;
   }
 
   /* prepare listener */
-  struct flextcp_listener listen;
-  if (flextcp_listen_open(&context, &listen, 1234, 32,
+  if (flextcp_listen_open(context, &listen, 1234, 32,
               FLEXTCP_LISTEN_REUSEPORT) != 0)
   {
     fprintf(stderr, "flextcp_listen_open failed\n");
@@ -158,7 +152,7 @@ static int test_1(void *data)
   struct flextcp_event evs[32];
   int n;
   do {
-    if ((n = flextcp_context_poll(&context, 1, evs)) < 0) {
+    if ((n = flextcp_context_poll(context, 1, evs)) < 0) {
       fprintf(stderr, "flextcp_context_poll failed\n");
       ret = 1;
       goto out;
@@ -210,7 +204,7 @@ static int test_1(void *data)
 
   /* wait for newconn event */
   do {
-    if ((n = flextcp_context_poll(&context, 1, evs)) < 0) {
+    if ((n = flextcp_context_poll(context, 1, evs)) < 0) {
       fprintf(stderr, "flextcp_context_poll failed\n");
       ret = 1;
       goto out;
@@ -228,8 +222,7 @@ static int test_1(void *data)
   } while (1);
 
   /* accept connection */
-  struct flextcp_connection conn;
-  if (flextcp_listen_accept(&context, &listen, &conn) != 0) {
+  if (flextcp_listen_accept(context, &listen, conn) != 0) {
     fprintf(stderr, "accept failed");
     ret = 1;
     goto out;
@@ -237,7 +230,7 @@ static int test_1(void *data)
 
   /* wait for accepted event */
   do {
-    if ((n = flextcp_context_poll(&context, 1, evs)) < 0) {
+    if ((n = flextcp_context_poll(context, 1, evs)) < 0) {
       fprintf(stderr, "flextcp_context_poll failed\n");
       ret = 1;
       goto out;
@@ -269,6 +262,30 @@ static int test_1(void *data)
       break;
   } while (1);
 
+  *psock = sock;
+out:
+  return ret;
+}
+
+static int test_1(void *data)
+{
+  struct flextcp_context context;
+  struct flextcp_connection conn;
+  struct flextcp_event evs[32];
+  pid_t tas_pid, npid;
+  int n, nret, sock, ret = 0;
+
+  /* start tas */
+  if ((tas_pid = start_tas(NULL)) < 0) {
+    fprintf(stderr, "start_tas failed\n");
+    return 1;
+  }
+
+  if (connect_tas(&context, &conn, &sock) != 0) {
+    ret = 1;
+    goto out;
+  }
+
   /* send some data */
   static char buffer[1024 * 32];
   ssize_t data_sent;
@@ -330,9 +347,119 @@ out:
   return ret;
 }
 
+/* TAS sends LOSS_BYTES to the Linux socket while dropping the given rate
+ * per million of the packets it transmits. Everything has to arrive intact
+ * within LOSS_TIMEOUT seconds; prints the goodput. */
+#define LOSS_BYTES (8 * 1024 * 1024)
+#define LOSS_TIMEOUT 60
+
+static int test_loss(void *data)
+{
+  static uint8_t rxbuf[64 * 1024];
+  unsigned ppm = *(unsigned *) data;
+  struct flextcp_context context;
+  struct flextcp_connection conn;
+  struct flextcp_event evs[32];
+  struct timespec start, now;
+  size_t tx = 0, rx = 0;
+  ssize_t len, i;
+  pid_t tas_pid, npid;
+  int nret, sock, ret = 0;
+  char lossopt[32];
+  uint8_t *buf;
+  double secs;
+
+  /* start tas */
+  sprintf(lossopt, "--fp-test-loss=%u", ppm);
+  if ((tas_pid = start_tas(lossopt)) < 0) {
+    fprintf(stderr, "start_tas failed\n");
+    return 1;
+  }
+
+  if (connect_tas(&context, &conn, &sock) != 0) {
+    ret = 1;
+    goto out;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (rx < LOSS_BYTES) {
+    /* fill free send buffer with a pattern */
+    if (tx < LOSS_BYTES && (len = flextcp_connection_tx_alloc(&conn,
+            LOSS_BYTES - tx, (void **) &buf)) > 0)
+    {
+      for (i = 0; i < len; i++) {
+        buf[i] = (tx + i) % 251;
+      }
+      if (flextcp_connection_tx_send(&context, &conn, len) != 0) {
+        fprintf(stderr, "flextcp_connection_tx_send failed\n");
+        ret = 1;
+        goto out;
+      }
+      tx += len;
+    }
+
+    /* only send buffer events expected, the poll pushes out sent data */
+    if (flextcp_context_poll(&context, 32, evs) < 0) {
+      fprintf(stderr, "flextcp_context_poll failed\n");
+      ret = 1;
+      goto out;
+    }
+
+    len = read(sock, rxbuf, sizeof(rxbuf));
+    if (len == 0 || (len < 0 && errno != EAGAIN)) {
+      perror("read failed");
+      ret = 1;
+      goto out;
+    }
+    for (i = 0; i < len; i++) {
+      if (rxbuf[i] != (rx + i) % 251) {
+        fprintf(stderr, "received wrong data at offset %zu\n", rx + i);
+        ret = 1;
+        goto out;
+      }
+    }
+    if (len > 0) {
+      rx += len;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - start.tv_sec > LOSS_TIMEOUT) {
+      fprintf(stderr, "loss %u ppm: timed out after %zu bytes\n", ppm, rx);
+      ret = 1;
+      goto out;
+    }
+  }
+
+  secs = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf(stderr, "loss %u ppm: success, %.1f Mbit/s\n", ppm,
+      rx * 8 / secs / 1e6);
+out:
+  /* send sigterm to TAS */
+  kill(tas_pid, SIGTERM);
+
+  /* wait for tas to terminate */
+  npid = waitpid(tas_pid, &nret, 0);
+  if (npid < 0) {
+    perror("waitpid failed");
+    return 1;
+  }
+
+  return ret;
+}
+
 int main(int argc, char *argv[])
 {
-  return start_testcase(test_1, NULL);
+  static unsigned loss_ppm[] = { 1000, 5000, 10000 };
+  unsigned i;
+  int ret;
+
+  ret = start_testcase(test_1, NULL);
+  for (i = 0; i < sizeof(loss_ppm) / sizeof(loss_ppm[0]); i++) {
+    if (start_testcase(test_loss, &loss_ppm[i]) != 0) {
+      ret = 1;
+    }
+  }
+  return ret;
 }
 
 static int start_testcase(int (*entry)(void *), void *data)
@@ -98,6 +98,113 @@ static struct rte_mbuf *mbuf_alloc(void)
   return tmb;
 }
 
+/* alloc dummy mbuf with a segment from the remote end, acking nothing new */
+static struct network_buf_handle *segment_alloc(uint32_t seq, uint16_t payload,
+    struct tcp_opts *opts)
+{
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct network_buf_handle *nbh = (struct network_buf_handle *) tmb;
+  struct pkt_tcp *p = network_buf_bufoff(nbh);
+  uint16_t optlen = (sizeof(*opts->ts) + 3) & ~3;
+
+  memset(p, 0, sizeof(*p) + optlen);
+  p->eth.type = t_beui16(ETH_TYPE_IP);
+  IPH_VHL_SET(&p->ip, 4, 5);
+  p->ip.len = t_beui16(sizeof(p->ip) + sizeof(p->tcp) + optlen + payload);
+  p->ip.proto = IP_PROTO_TCP;
+  p->ip.src = t_beui32(TEST_IP);
+  p->ip.dest = t_beui32(TEST_LIP);
+  p->tcp.src = t_beui16(TEST_PORT);
+  p->tcp.dest = t_beui16(TEST_LPORT);
+  p->tcp.seqno = t_beui32(seq);
+  p->tcp.ackno = t_beui32(1);
+  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, TCP_ACK);
+  p->tcp.wnd = t_beui16(8192);
+
+  opts->ts = (struct tcp_timestamp_opt *) (p + 1);
+  opts->ts->kind = TCP_OPT_TIMESTAMP;
+  opts->ts->length = sizeof(*opts->ts);
+  memset((uint8_t *) (p + 1) + optlen, 0x5a, payload);
+
+  network_buf_setlen(nbh, sizeof(*p) + optlen + payload);
+  return nbh;
+}
+
+/* alloc dummy mbuf with a pure ack from the remote end carrying n SACK blocks,
+ * and parse its options into opts */
+static struct network_buf_handle *sack_alloc(uint32_t ack, unsigned n,
+    const uint32_t *blocks, struct tcp_opts *opts)
+{
+  struct network_buf_handle *nbh = segment_alloc(1, 0, opts);
+  struct pkt_tcp *p = network_buf_bufoff(nbh);
+  uint8_t *opt = (uint8_t *) (p + 1);
+  struct tcp_sack_opt *sack = (struct tcp_sack_opt *) (opt + 14);
+  uint16_t optlen = (n > 0 ? 16 + 8 * n : 12);
+  unsigned i;
+
+  /* timestamp, NOP, NOP, NOP, NOP, SACK */
+  p->ip.len = t_beui16(sizeof(p->ip) + sizeof(p->tcp) + optlen);
+  p->tcp.ackno = t_beui32(ack);
+  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, TCP_ACK);
+  if (n > 0) {
+    memset(opt + 10, TCP_OPT_NO_OP, 4);
+    sack->kind = TCP_OPT_SACK;
+    sack->length = 2 + 8 * n;
+    for (i = 0; i < n; i++) {
+      sack->blocks[i].start = t_beui32(blocks[2 * i]);
+      sack->blocks[i].end = t_beui32(blocks[2 * i + 1]);
+    }
+  }
+  network_buf_setlen(nbh, sizeof(*p) + optlen);
+
+  test_assert("options parsed",
+      tcp_parse_options(p, sizeof(*p) + optlen, opts) == 0 &&
+      opts->sack == (n > 0 ? sack : NULL) &&
+      opts->ts == (struct tcp_timestamp_opt *) opt);
+  return nbh;
+}
+
+/* check a segment the flow sent */
+static void segment_check(struct network_buf_handle *nbh, uint32_t seq,
+    uint16_t payload)
+{
+  struct pkt_tcp *p = network_buf_buf(nbh);
+
+  test_assert("segment seq", f_beui32(p->tcp.seqno) == seq);
+  test_assert("segment ip len",
+      f_beui16(p->ip.len) == sizeof(p->ip) + TCPH_HDRLEN(&p->tcp) * 4 + payload);
+}
+
+/* check the ack fast_flows_packet sent in nbh, with n SACK blocks */
+static void ack_check(struct network_buf_handle *nbh, uint32_t ack,
+    unsigned n, const uint32_t *blocks)
+{
+  struct pkt_tcp *p = network_buf_bufoff(nbh);
+  uint8_t *opt = (uint8_t *) (p + 1);
+  struct tcp_sack_opt *sack;
+  unsigned i;
+
+  test_assert("ack number", f_beui32(p->tcp.ackno) == ack);
+  test_assert("ack ports", f_beui16(p->tcp.src) == TEST_LPORT &&
+      f_beui16(p->tcp.dest) == TEST_PORT);
+  if (n == 0) {
+    test_assert("ack without sack", TCPH_HDRLEN(&p->tcp) == 8);
+    return;
+  }
+
+  test_assert("ack header length", TCPH_HDRLEN(&p->tcp) == 9 + 2 * n);
+  test_assert("ack ip length",
+      f_beui16(p->ip.len) == sizeof(p->ip) + TCPH_HDRLEN(&p->tcp) * 4);
+  test_assert("ack timestamp option", opt[2] == TCP_OPT_TIMESTAMP);
+  sack = (struct tcp_sack_opt *) (opt + 14);
+  test_assert("ack sack option", sack->kind == TCP_OPT_SACK &&
+      sack->length == 2 + 8 * n);
+  for (i = 0; i < n; i++) {
+    test_assert("sack block", f_beui32(sack->blocks[i].start) == blocks[2 * i]
+        && f_beui32(sack->blocks[i].end) == blocks[2 * i + 1]);
+  }
+}
+
 void test_txbump_small(void *arg)
 {
   int ret;
@@ -287,11 +394,375 @@ void test_retransmit(void *arg)
       (QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL));
 }
 
+/* Test a queue manager activation for more data than fits into one segment
+ * but with fewer buffers than the burst size. The flow sends one segment per
+ * buffer and hands the rest of the chunk back to the queue manager.
+ */
+void test_qman_burst(void *arg)
+{
+  int ret;
+  unsigned i;
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct network_buf_handle *nbhs[2];
+  struct dataplane_context ctx;
+  struct pkt_tcp *p;
+  memset(&ctx, 0, sizeof(ctx));
+
+  flow_init(0, 8192, 8192, 123456);
+  fs->tx_avail = 4096;
+  fs->tx_next_seq = 1;
+  config.fp_tx_burst = 4;
+
+  for (i = 0; i < 2; i++) {
+    nbhs[i] = (struct network_buf_handle *) mbuf_alloc();
+  }
+
+  ret = fast_flows_qman(&ctx, 0, 4 * 1448, nbhs, 2, 0);
+  test_assert("used both tx buffers", ret == 2);
+  test_assert("tx queue num done", ctx.tx_num == 2);
+  test_assert("tx sent updated", fs->tx_sent == 2 * 1448);
+  test_assert("tx avail updated", fs->tx_avail == 4096 - 2 * 1448);
+
+  for (i = 0; i < 2; i++) {
+    p = network_buf_buf(nbhs[i]);
+    test_assert("segment seq", f_beui32(p->tcp.seqno) == 1 + i * 1448);
+    test_assert("segment ip len", f_beui16(p->ip.len) == 1500);
+    test_assert("segment ports", f_beui16(p->tcp.src) == TEST_LPORT &&
+        f_beui16(p->tcp.dest) == TEST_PORT);
+  }
+
+  test_assert("qman set sent", qm_set_op.got_op);
+  test_assert("qman set avail correct", qm_set_op.avail == 4096 - 2 * 1448);
+  test_assert("qman set flags", qm_set_op.flags == QMAN_ADD_AVAIL);
+}
+
+/* Test out of order segments creating, extending, and merging intervals, and
+ * the SACK blocks in the acks for them. The first block is the interval that
+ * received data last.
+ */
+void test_ooo_sack(void *arg)
+{
+  int ret;
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowext *fe = &state_base.flowext[0];
+  struct network_buf_handle *nbh;
+  struct dataplane_context ctx;
+  struct tcp_opts opts;
+  memset(&ctx, 0, sizeof(ctx));
+
+  flow_init(0, 8192, 8192, 123456);
+  fs->rx_base_sp |= FLEXNIC_PL_FLOWST_SACK;
+  fs->rx_next_seq = 1;
+  fs->tx_next_seq = 1;
+
+  nbh = segment_alloc(1001, 100, &opts);
+  ret = fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("ack sent", ret == 1 && ctx.tx_num == 1);
+  test_assert("one interval", fs->rx_ooo_cnt == 1 &&
+      fe->rx_ooo[0].start == 1001 && fe->rx_ooo[0].len == 100);
+  ack_check(nbh, 1, 1, (uint32_t []) { 1001, 1101 });
+
+  nbh = segment_alloc(3001, 100, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("two intervals", fs->rx_ooo_cnt == 2 &&
+      fe->rx_ooo[1].start == 3001 && fe->rx_ooo[1].len == 100);
+  ack_check(nbh, 1, 2, (uint32_t []) { 3001, 3101, 1001, 1101 });
+
+  nbh = segment_alloc(1101, 100, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("interval extended", fs->rx_ooo_cnt == 2 &&
+      fe->rx_ooo[0].start == 1001 && fe->rx_ooo[0].len == 200);
+  ack_check(nbh, 1, 2, (uint32_t []) { 1001, 1201, 3001, 3101 });
+
+  nbh = segment_alloc(1201, 1000, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  nbh = segment_alloc(2201, 800, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("intervals merged", fs->rx_ooo_cnt == 1 &&
+      fe->rx_ooo[0].start == 1001 && fe->rx_ooo[0].len == 2100);
+  ack_check(nbh, 1, 1, (uint32_t []) { 1001, 3101 });
+
+  nbh = segment_alloc(1, 1000, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("caught up", fs->rx_ooo_cnt == 0 && fs->rx_next_seq == 3101 &&
+      fs->rx_next_pos == 3100 && fs->rx_avail == 8192 - 3100);
+  test_assert("rx bump covers interval", ctx.arx_num == 1 &&
+      ctx.arx_cache[0].msg.connupdate.rx_bump == 3100);
+  ack_check(nbh, 3101, 0, NULL);
+}
+
+/* Test that a segment needing a fifth interval is dropped and the first four
+ * are kept.
+ */
+void test_ooo_full(void *arg)
+{
+  unsigned i;
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowext *fe = &state_base.flowext[0];
+  struct network_buf_handle *nbh;
+  struct dataplane_context ctx;
+  struct tcp_opts opts;
+  memset(&ctx, 0, sizeof(ctx));
+
+  flow_init(0, 8192, 8192, 123456);
+  fs->rx_next_seq = 1;
+  fs->tx_next_seq = 1;
+
+  for (i = 0; i < FLEXNIC_PL_OOO_INTERVALS + 1; i++) {
+    nbh = segment_alloc(1001 + i * 1000, 100, &opts);
+    fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  }
+  test_assert("intervals full", fs->rx_ooo_cnt == FLEXNIC_PL_OOO_INTERVALS &&
+      fe->rx_ooo[FLEXNIC_PL_OOO_INTERVALS - 1].start ==
+      1001 + (FLEXNIC_PL_OOO_INTERVALS - 1) * 1000);
+  /* flow did not negotiate SACK */
+  ack_check(nbh, 1, 0, NULL);
+
+  nbh = segment_alloc(1, 1100, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("caught up with first", fs->rx_ooo_cnt ==
+      FLEXNIC_PL_OOO_INTERVALS - 1 && fs->rx_next_seq == 1101 &&
+      fe->rx_ooo[0].start == 2001);
+}
+
+/* Test selective retransmission after three duplicate acks with SACK blocks:
+ * only the two holes are resent, followed by new data, and the flow leaves
+ * recovery once everything sent before it is acknowledged.
+ */
+void test_sack_rexmit(void *arg)
+{
+  int ret;
+  unsigned i;
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct network_buf_handle *nbh, *nbhs[4];
+  struct dataplane_context ctx;
+  struct tcp_opts opts;
+  memset(&ctx, 0, sizeof(ctx));
+
+  /* 5 segments sent, the second and the fourth are lost */
+  flow_init(0, 16384, 16384, 123456);
+  fs->rx_base_sp |= FLEXNIC_PL_FLOWST_SACK;
+  fs->rx_next_seq = 1;
+  fs->rx_remote_avail = 8192;
+  fs->tx_next_seq = 1 + 5 * 1448;
+  fs->tx_next_pos = 5 * 1448;
+  fs->tx_sent = 5 * 1448;
+  fs->tx_avail = 1000;
+  config.fp_tx_burst = 4;
+
+  nbh = sack_alloc(1449, 1, (uint32_t []) { 2897, 4345 }, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("first block recorded", fs->tx_sack_cnt == 1 &&
+      fs->tx_sent == 4 * 1448 && fs->tx_rexmit == 0);
+
+  for (i = 0; i < 3; i++) {
+    qm_set_op.got_op = 0;
+    nbh = sack_alloc(1449, 2, (uint32_t []) { 5793, 7241, 2897, 4345 },
+        &opts);
+    fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  }
+  test_assert("two blocks recorded", fs->tx_sack_cnt == 2);
+  test_assert("selective recovery", fs->tx_rexmit == FLEXNIC_PL_REXMIT_SACK &&
+      fs->tx_sent == 4 * 1448 && fs->tx_next_seq == 1 + 5 * 1448);
+  test_assert("rate halved", fs->tx_rate == 5000 && fs->cnt_tx_drops == 1);
+  test_assert("qman gets holes", qm_set_op.got_op &&
+      qm_set_op.avail == 2 * 1448);
+
+  for (i = 0; i < 4; i++) {
+    nbhs[i] = (struct network_buf_handle *) mbuf_alloc();
+  }
+  ctx.tx_num = 0;
+  ret = fast_flows_qman(&ctx, 0, 4 * 1448, nbhs, 4, 0);
+  test_assert("holes and new data sent", ret == 3 && ctx.tx_num == 3);
+  segment_check(nbhs[0], 1449, 1448);
+  segment_check(nbhs[1], 4345, 1448);
+  segment_check(nbhs[2], 7241, 1000);
+  test_assert("new data accounted", fs->tx_next_seq == 8241 &&
+      fs->tx_sent == 4 * 1448 + 1000 && fs->tx_avail == 0);
+  test_assert("holes resent once", fs->tx_rexmit != 0 &&
+      fp_state->flowext[0].tx_rexmit_seq == 7241);
+
+  nbh = sack_alloc(7241, 0, NULL, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("recovery done", fs->tx_rexmit == 0 && fs->tx_sack_cnt == 0 &&
+      fs->tx_sent == 1000);
+}
+
+/* Test a timeout with SACK blocks: everything not SACKed up to the data sent
+ * is resent, and a second timeout falls back to resending everything.
+ */
+void test_sack_timeout(void *arg)
+{
+  int ret;
+  unsigned i;
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct network_buf_handle *nbh, *nbhs[4];
+  struct dataplane_context ctx;
+  struct tcp_opts opts;
+  memset(&ctx, 0, sizeof(ctx));
+
+  /* 4 segments sent, only the third arrived */
+  flow_init(0, 16384, 16384, 123456);
+  fs->rx_base_sp |= FLEXNIC_PL_FLOWST_SACK;
+  fs->rx_next_seq = 1;
+  fs->rx_remote_avail = 8192;
+  fs->tx_next_seq = 1 + 4 * 1448;
+  fs->tx_next_pos = 4 * 1448;
+  fs->tx_sent = 4 * 1448;
+  config.fp_tx_burst = 4;
+
+  nbh = sack_alloc(1, 1, (uint32_t []) { 2897, 4345 }, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("block recorded", fs->tx_sack_cnt == 1 && fs->tx_rexmit == 0);
+
+  qm_set_op.got_op = 0;
+  fast_flows_retransmit(&ctx, 0);
+  test_assert("selective recovery", fs->tx_rexmit == FLEXNIC_PL_REXMIT_RTO &&
+      fs->tx_sent == 4 * 1448);
+  test_assert("qman gets holes", qm_set_op.got_op &&
+      qm_set_op.avail == 3 * 1448);
+
+  for (i = 0; i < 4; i++) {
+    nbhs[i] = (struct network_buf_handle *) mbuf_alloc();
+  }
+  ctx.tx_num = 0;
+  ret = fast_flows_qman(&ctx, 0, 4 * 1448, nbhs, 4, 0);
+  test_assert("holes sent", ret == 3 && ctx.tx_num == 3);
+  segment_check(nbhs[0], 1, 1448);
+  segment_check(nbhs[1], 1449, 1448);
+  segment_check(nbhs[2], 4345, 1448);
+
+  fast_flows_retransmit(&ctx, 0);
+  test_assert("go back n", fs->tx_rexmit == 0 && fs->tx_sack_cnt == 0 &&
+      fs->tx_sent == 0 && fs->tx_next_seq == 1 && fs->tx_avail == 4 * 1448);
+}
+
+/* Test queue manager chunks smaller than the burst: holes and new data are
+ * sent only up to the chunk, a hole is split where the chunk ends, and
+ * nothing is handed back.
+ */
+void test_qman_chunk(void *arg)
+{
+  int ret;
+  unsigned i;
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct network_buf_handle *nbh, *nbhs[4];
+  struct dataplane_context ctx;
+  struct tcp_opts opts;
+  memset(&ctx, 0, sizeof(ctx));
+
+  /* 4 segments sent, only the third arrived, more data queued */
+  flow_init(0, 16384, 16384, 123456);
+  fs->rx_base_sp |= FLEXNIC_PL_FLOWST_SACK;
+  fs->rx_next_seq = 1;
+  fs->rx_remote_avail = 8192;
+  fs->tx_next_seq = 1 + 4 * 1448;
+  fs->tx_next_pos = 4 * 1448;
+  fs->tx_sent = 4 * 1448;
+  config.fp_tx_burst = 4;
+
+  nbh = sack_alloc(1, 1, (uint32_t []) { 2897, 4345 }, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  fast_flows_retransmit(&ctx, 0);
+  test_assert("selective recovery", fs->tx_rexmit == FLEXNIC_PL_REXMIT_RTO);
+  fs->tx_avail = 4096;
+
+  for (i = 0; i < 4; i++) {
+    nbhs[i] = (struct network_buf_handle *) mbuf_alloc();
+  }
+  ctx.tx_num = 0;
+  qm_set_op.got_op = 0;
+  ret = fast_flows_qman(&ctx, 0, 1448 + 500, nbhs, 4, 0);
+  test_assert("chunk ends in a hole", ret == 2 && ctx.tx_num == 2);
+  segment_check(nbhs[0], 1, 1448);
+  segment_check(nbhs[1], 1449, 500);
+  test_assert("hole resumes at chunk end",
+      fp_state->flowext[0].tx_rexmit_seq == 1949);
+  test_assert("no new data sent", fs->tx_avail == 4096 &&
+      fs->tx_next_seq == 1 + 4 * 1448);
+  test_assert("nothing handed back", !qm_set_op.got_op);
+
+  for (i = 0; i < 4; i++) {
+    nbhs[i] = (struct network_buf_handle *) mbuf_alloc();
+  }
+  ctx.tx_num = 0;
+  ret = fast_flows_qman(&ctx, 0, 948 + 1448 + 100, nbhs, 4, 0);
+  test_assert("holes and new data sent", ret == 3 && ctx.tx_num == 3);
+  segment_check(nbhs[0], 1949, 948);
+  segment_check(nbhs[1], 4345, 1448);
+  segment_check(nbhs[2], 5793, 100);
+  test_assert("new data up to chunk end", fs->tx_avail == 4096 - 100 &&
+      fs->tx_next_seq == 5893);
+  test_assert("nothing handed back", !qm_set_op.got_op);
+}
+
+/* Test zero-copy transmit after a timeout: resent segments are copied even
+ * if long, and an ack hands the bytes back to the application right away.
+ */
+void test_txzc_rexmit(void *arg)
+{
+  int ret;
+  unsigned i;
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct network_buf_handle *nbh, *nbhs[4];
+  struct dataplane_context ctx;
+  struct tcp_opts opts;
+  struct pkt_tcp *p;
+  uint8_t *txbuf, *payload;
+  memset(&ctx, 0, sizeof(ctx));
+
+  /* 2 segments sent, both lost, more data queued */
+  flow_init(0, 16384, 16384, 123456);
+  txbuf = (uint8_t *) (uintptr_t) fs->tx_base;
+  for (i = 0; i < 4096; i++) {
+    txbuf[i] = i * 7;
+  }
+  fs->rx_next_seq = 1;
+  fs->rx_remote_avail = 8192;
+  fs->tx_next_seq = 1 + 2 * 1448;
+  fs->tx_next_pos = 2 * 1448;
+  fs->tx_sent = 2 * 1448;
+  fs->tx_avail = 100;
+  fp_state->flowext[0].tx_zc_max_seq = 1 + 2 * 1448;
+  config.fp_tx_burst = 4;
+  config.fp_tx_zerocopy = 1;
+
+  fast_flows_retransmit(&ctx, 0);
+  test_assert("go back n", fs->tx_sent == 0 && fs->tx_next_seq == 1);
+
+  for (i = 0; i < 4; i++) {
+    nbhs[i] = (struct network_buf_handle *) mbuf_alloc();
+  }
+  ctx.tx_num = 0;
+  ret = fast_flows_qman(&ctx, 0, 2 * 1448 + 100, nbhs, 4, 0);
+  test_assert("resent and new data sent", ret == 3 && ctx.tx_num == 3);
+  segment_check(nbhs[0], 1, 1448);
+  segment_check(nbhs[1], 1449, 1448);
+  segment_check(nbhs[2], 2897, 100);
+  for (i = 0; i < 3; i++) {
+    p = network_buf_buf(nbhs[i]);
+    payload = (uint8_t *) &p->tcp + TCPH_HDRLEN(&p->tcp) * 4;
+    test_assert("payload copied", ((struct rte_mbuf *) nbhs[i])->next == NULL &&
+        memcmp(payload, txbuf + i * 1448, i < 2 ? 1448 : 100) == 0);
+  }
+  test_assert("new data recorded",
+      fp_state->flowext[0].tx_zc_max_seq == 2997);
+
+  nbh = sack_alloc(2997, 0, NULL, &opts);
+  fast_flows_packet(&ctx, nbh, fs, &opts, 0);
+  test_assert("acked bytes released", fs->tx_sent == 0 && ctx.arx_num == 1 &&
+      ctx.arx_cache[0].msg.connupdate.tx_bump == 2 * 1448 + 100);
+
+  config.fp_tx_zerocopy = 0;
+}
+
 int main(int argc, char *argv[])
 {
   int ret = 0;
 
   memset(&state_base, 0, sizeof(state_base));
+  /* one segment per queue manager activation */
+  config.fp_tx_burst = 1;
 
   if (test_subcase("tx bump small", test_txbump_small, NULL))
     ret = 1;
@@ -318,5 +789,26 @@ int main(int argc, char *argv[])
   if (test_subcase("retransmit", test_retransmit, NULL))
     ret = 1;
 
+  if (test_subcase("qman burst", test_qman_burst, NULL))
+    ret = 1;
+
+  if (test_subcase("qman chunk", test_qman_chunk, NULL))
+    ret = 1;
+
+  if (test_subcase("ooo sack", test_ooo_sack, NULL))
+    ret = 1;
+
+  if (test_subcase("ooo full", test_ooo_full, NULL))
+    ret = 1;
+
+  if (test_subcase("sack rexmit", test_sack_rexmit, NULL))
+    ret = 1;
+
+  if (test_subcase("sack timeout", test_sack_timeout, NULL))
+    ret = 1;
+
+  if (test_subcase("tx zerocopy rexmit", test_txzc_rexmit, NULL))
+    ret = 1;
+
   return ret;
 }
@@ -123,6 +123,7 @@ static int dump_flow(uint32_t flow_id)
          "  db_id=%03u\n"
          "  flag_slowpath=%u\n"
          "  flag_ecn=%u\n"
+         "  flag_sack=%u\n"
          "  flag_txfin=%u\n"
          "  flag_rxfin=%u\n"
          "  bump_seq=%010u\n"
@@ -142,8 +143,7 @@ static int dump_flow(uint32_t flow_id)
          "        next_seq=%010u\n"
          "      dupack_cnt=%08x\n"
 #ifdef FLEXNIC_PL_OOO_RECV
-         "       ooo_start=%08x\n"
-         "         ooo_len=%08x\n"
+         "         ooo_cnt=%08x\n"
 #endif
          "  }\n"
          "  tx {\n"
@@ -154,6 +154,8 @@ static int dump_flow(uint32_t flow_id)
          "        next_pos=%08x\n"
          "        next_seq=%010u\n"
          "         next_ts=%08x\n"
+         "        sack_cnt=%08x\n"
+         "          rexmit=%08x\n"
          "  }\n"
          "  cc {\n"
          "         tx_rate=%10u\n"
@@ -166,6 +168,7 @@ static int dump_flow(uint32_t flow_id)
          "}\n", flow_id, fs->opaque, fs->db_id,
       !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_SLOWPATH),
       !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_ECN),
+      !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_SACK),
       !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN),
       !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_RXFIN),
       fs->bump_seq,
@@ -174,10 +177,10 @@ static int dump_flow(uint32_t flow_id)
       (fs->rx_base_sp & FLEXNIC_PL_FLOWST_RX_MASK), fs->rx_len, fs->rx_avail,
       fs->rx_remote_avail, fs->rx_next_pos, fs->rx_next_seq, fs->rx_dupack_cnt,
 #ifdef FLEXNIC_PL_OOO_RECV
-      fs->rx_ooo_start, fs->rx_ooo_len,
+      fs->rx_ooo_cnt,
 #endif
       fs->tx_base, fs->tx_len, fs->tx_avail, fs->tx_sent, fs->tx_next_pos,
-      fs->tx_next_seq, fs->tx_next_ts,
+      fs->tx_next_seq, fs->tx_next_ts, fs->tx_sack_cnt, fs->tx_rexmit,
       fs->tx_rate, fs->cnt_tx_drops, fs->cnt_rx_acks, fs->cnt_rx_ack_bytes,
       fs->cnt_rx_ecn_bytes, fs->rtt_est);
 